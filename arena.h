@@ -0,0 +1,98 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+#include <algorithm>
+#include <cstddef>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <vector>
+
+// monotonic memory holding everything a scene owns
+// allocations are bumped out of one cache line aligned block and are only given back all together by release()
+// requests that don't fit get their own allocation, release() then regrows the block so the next scene fits in one
+// allocating is thread safe so that a scene can be loaded by several tasks at once
+class scene_arena : public std::pmr::memory_resource
+{
+public:
+	static constexpr size_t alignment = 64;
+
+	explicit scene_arena(size_t capacity = 1 << 20) { reserve(capacity); }
+	~scene_arena() override
+	{
+		free_overflow();
+		::operator delete(block, std::align_val_t(alignment));
+	}
+
+	scene_arena(scene_arena const&) = delete;
+	scene_arena& operator=(scene_arena const&) = delete;
+
+	// forgets every allocation at once, nothing allocated from the arena may be used afterwards
+	void release() noexcept
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		size_t const peak = total;
+		free_overflow();
+		if (peak > capacity_)
+		{
+			::operator delete(block, std::align_val_t(alignment));
+			block = nullptr;
+			reserve(peak);
+		}
+		offset = 0;
+		total = 0;
+	}
+
+	[[nodiscard]] size_t used() const noexcept { return total; }
+	[[nodiscard]] size_t capacity() const noexcept { return capacity_; }
+	[[nodiscard]] size_t overflow_count() const noexcept { return overflow.size(); }
+
+private:
+	void reserve(size_t bytes)
+	{
+		capacity_ = (bytes + alignment - 1) & ~(alignment - 1);
+		block = static_cast<std::byte*>(::operator new(capacity_, std::align_val_t(alignment)));
+	}
+
+	void free_overflow() noexcept
+	{
+		for (auto const& o : overflow)
+			::operator delete(o.ptr, std::align_val_t(o.align));
+		overflow.clear();
+	}
+
+	void* do_allocate(size_t bytes, size_t align) override
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		// every array starts on its own cache line
+		align = std::max(align, alignment);
+		total += bytes + align;
+		size_t const start = (offset + align - 1) & ~(align - 1);
+		if (start + bytes <= capacity_)
+		{
+			offset = start + bytes;
+			return block + start;
+		}
+		void* const p = ::operator new(bytes, std::align_val_t(align));
+		overflow.push_back({ p, align });
+		return p;
+	}
+
+	void do_deallocate(void*, size_t, size_t) override {}
+
+	bool do_is_equal(std::pmr::memory_resource const& other) const noexcept override { return this == &other; }
+
+	struct allocation
+	{
+		void* ptr;
+		size_t align;
+	};
+
+	std::byte* block = nullptr;
+	size_t capacity_ = 0;
+	size_t offset = 0;
+	size_t total = 0;	// bytes a single block would need to hold everything allocated so far
+	std::vector<allocation> overflow;
+	std::mutex lock;
+};
+
+#endif //__ARENA_H__
@@ -2,12 +2,17 @@
 #define __GEOMETRY_H__
 #include <cmath>
 #include <cassert>
+#include <algorithm>
 #include <iostream>
+#include <type_traits>
+#include <utility>
 
 template <size_t DIM, typename T> struct vec {
-    vec() { for (size_t i=DIM; i--; data_[i] = T()); }
-          T& operator[](const size_t i)       { assert(i<DIM); return data_[i]; }
-    const T& operator[](const size_t i) const { assert(i<DIM); return data_[i]; }
+    constexpr vec() : data_{} {}
+    template <typename... U, typename = std::enable_if_t<sizeof...(U) == DIM && DIM != 1>>
+    constexpr vec(U... u) : data_{ T(u)... } {}
+    constexpr       T& operator[](const size_t i)       { assert(i<DIM); return data_[i]; }
+    constexpr const T& operator[](const size_t i) const { assert(i<DIM); return data_[i]; }
 private:
     T data_[DIM];
 };
@@ -17,61 +22,94 @@ typedef vec<3, float> vec3f;
 typedef vec<3, int  > vec3i;
 typedef vec<4, float> vec4f;
 
+// the named specializations index their components through a member pointer table rather than a branch chain
 template <typename T> struct vec<2,T> {
-    vec() : x(T()), y(T()) {}
-    vec(T X, T Y) : x(X), y(Y) {}
+    constexpr vec() : x(T()), y(T()) {}
+    constexpr vec(T X, T Y) : x(X), y(Y) {}
     template <class U> vec<2,T>(const vec<2,U> &v);
-          T& operator[](const size_t i)       { assert(i<2); return i<=0 ? x : y; }
-    const T& operator[](const size_t i) const { assert(i<2); return i<=0 ? x : y; }
+    constexpr       T& operator[](const size_t i)       { assert(i<2); return this->*component(i); }
+    constexpr const T& operator[](const size_t i) const { assert(i<2); return this->*component(i); }
     T x,y;
+private:
+    static constexpr T vec::* component(const size_t i) { T vec::* const c[] = { &vec::x, &vec::y }; return c[i]; }
 };
 
 template <typename T> struct vec<3,T> {
-    vec() : x(T()), y(T()), z(T()) {}
-    vec(T X, T Y, T Z) : x(X), y(Y), z(Z) {}
-          T& operator[](const size_t i)       { assert(i<3); return i<=0 ? x : (1==i ? y : z); }
-    const T& operator[](const size_t i) const { assert(i<3); return i<=0 ? x : (1==i ? y : z); }
+    constexpr vec() : x(T()), y(T()), z(T()) {}
+    constexpr vec(T X, T Y, T Z) : x(X), y(Y), z(Z) {}
+    constexpr       T& operator[](const size_t i)       { assert(i<3); return this->*component(i); }
+    constexpr const T& operator[](const size_t i) const { assert(i<3); return this->*component(i); }
 	float norm() const { return std::sqrt(x * x + y * y + z * z); }
-	float norm2() const { return (x*x+y*y+z*z); }
+	constexpr float norm2() const { return (x*x+y*y+z*z); }
     vec<3,T> & normalize(T l=1) { *this = (*this)*(l/norm()); return *this; }
     T x,y,z;
+private:
+    static constexpr T vec::* component(const size_t i) { T vec::* const c[] = { &vec::x, &vec::y, &vec::z }; return c[i]; }
 };
 
-template <typename T> struct vec<4,T> {
-    vec() : x(T()), y(T()), z(T()), w(T()) {}
-    vec(T X, T Y, T Z, T W) : x(X), y(Y), z(Z), w(W) {}
+// 16 bytes aligned when it fits a SIMD register, so colors can be moved with aligned vector loads
+template <typename T> struct alignas(sizeof(T) * 4 == 16 ? 16 : alignof(T)) vec<4,T> {
+    constexpr vec() : x(T()), y(T()), z(T()), w(T()) {}
+    constexpr vec(T X, T Y, T Z, T W) : x(X), y(Y), z(Z), w(W) {}
 	float norm() const { return std::sqrt(x * x + y * y + z * z + w * w); }
-	float norm2() const { return (x * x + y * y + z * z + w * w); }
-          T& operator[](const size_t i)       { assert(i<4); return i<=0 ? x : (1==i ? y : (2==i ? z : w)); }
-    const T& operator[](const size_t i) const { assert(i<4); return i<=0 ? x : (1==i ? y : (2==i ? z : w)); }
+	constexpr float norm2() const { return (x * x + y * y + z * z + w * w); }
+    constexpr       T& operator[](const size_t i)       { assert(i<4); return this->*component(i); }
+    constexpr const T& operator[](const size_t i) const { assert(i<4); return this->*component(i); }
     T x,y,z,w;
+private:
+    static constexpr T vec::* component(const size_t i) { T vec::* const c[] = { &vec::x, &vec::y, &vec::z, &vec::w }; return c[i]; }
 };
 
-template<size_t DIM,typename T>vec<DIM,T> operator+(vec<DIM,T> lhs, const vec<DIM,T>& rhs) {
-    for (size_t i=DIM; i--; lhs[i]+=rhs[i]);
-    return lhs;
+static_assert(alignof(vec4f) == 16, "vec4f must be SIMD aligned");
+
+// generic component wise arithmetic, expanded at compile time over an index_sequence
+template<size_t DIM, typename T, typename F, size_t... I>
+constexpr vec<DIM,T> vec_map(F f, std::index_sequence<I...>) {
+    return vec<DIM,T>(f(I)...);
 }
 
-template<size_t DIM,typename T>vec<DIM,T> operator-(vec<DIM,T> lhs, const vec<DIM,T>& rhs) {
-    for (size_t i=DIM; i--; lhs[i]-=rhs[i]);
-    return lhs;
+template<size_t DIM,typename T> constexpr vec<DIM,T> operator+(const vec<DIM,T>& lhs, const vec<DIM,T>& rhs) {
+    return vec_map<DIM,T>([&](size_t i) { return lhs[i] + rhs[i]; }, std::make_index_sequence<DIM>());
 }
 
-template<size_t DIM,typename T,typename U> vec<DIM,T> operator*(const vec<DIM,T> &lhs, const U& rhs) {
-    vec<DIM,T> ret;
-    for (size_t i=DIM; i--; ret[i]=lhs[i]*rhs);
-    return ret;
+template<size_t DIM,typename T> constexpr vec<DIM,T> operator-(const vec<DIM,T>& lhs, const vec<DIM,T>& rhs) {
+    return vec_map<DIM,T>([&](size_t i) { return lhs[i] - rhs[i]; }, std::make_index_sequence<DIM>());
 }
 
-template<size_t DIM, typename T, typename U> vec<DIM, T> operator*(const U& rhs, const vec<DIM, T>& lhs) {
+template<size_t DIM,typename T,typename U> constexpr vec<DIM,T> operator*(const vec<DIM,T> &lhs, const U& rhs) {
+    return vec_map<DIM,T>([&](size_t i) { return T(lhs[i] * rhs); }, std::make_index_sequence<DIM>());
+}
+
+template<size_t DIM, typename T, typename U> constexpr vec<DIM, T> operator*(const U& rhs, const vec<DIM, T>& lhs) {
     return lhs * rhs;
 }
 
-template<size_t DIM,typename T> vec<DIM,T> operator-(const vec<DIM,T> &lhs) {
+template<size_t DIM,typename T> constexpr vec<DIM,T> operator-(const vec<DIM,T> &lhs) {
     return lhs*T(-1);
 }
 
-template <typename T> vec<3,T> cross(vec<3,T> v1, vec<3,T> v2) {
+// named component versions for the common sizes, no indexing at all
+template<typename T> constexpr vec<2,T> operator+(const vec<2,T>& l, const vec<2,T>& r) { return vec<2,T>(l.x + r.x, l.y + r.y); }
+template<typename T> constexpr vec<3,T> operator+(const vec<3,T>& l, const vec<3,T>& r) { return vec<3,T>(l.x + r.x, l.y + r.y, l.z + r.z); }
+template<typename T> constexpr vec<4,T> operator+(const vec<4,T>& l, const vec<4,T>& r) { return vec<4,T>(l.x + r.x, l.y + r.y, l.z + r.z, l.w + r.w); }
+
+template<typename T> constexpr vec<2,T> operator-(const vec<2,T>& l, const vec<2,T>& r) { return vec<2,T>(l.x - r.x, l.y - r.y); }
+template<typename T> constexpr vec<3,T> operator-(const vec<3,T>& l, const vec<3,T>& r) { return vec<3,T>(l.x - r.x, l.y - r.y, l.z - r.z); }
+template<typename T> constexpr vec<4,T> operator-(const vec<4,T>& l, const vec<4,T>& r) { return vec<4,T>(l.x - r.x, l.y - r.y, l.z - r.z, l.w - r.w); }
+
+template<typename T,typename U> constexpr vec<2,T> operator*(const vec<2,T>& l, const U& s) { return vec<2,T>(T(l.x * s), T(l.y * s)); }
+template<typename T,typename U> constexpr vec<3,T> operator*(const vec<3,T>& l, const U& s) { return vec<3,T>(T(l.x * s), T(l.y * s), T(l.z * s)); }
+template<typename T,typename U> constexpr vec<4,T> operator*(const vec<4,T>& l, const U& s) { return vec<4,T>(T(l.x * s), T(l.y * s), T(l.z * s), T(l.w * s)); }
+
+template<typename T,typename U> constexpr vec<2,T> operator*(const U& s, const vec<2,T>& r) { return r * s; }
+template<typename T,typename U> constexpr vec<3,T> operator*(const U& s, const vec<3,T>& r) { return r * s; }
+template<typename T,typename U> constexpr vec<4,T> operator*(const U& s, const vec<4,T>& r) { return r * s; }
+
+template<typename T> constexpr vec<2,T> operator-(const vec<2,T>& v) { return vec<2,T>(-v.x, -v.y); }
+template<typename T> constexpr vec<3,T> operator-(const vec<3,T>& v) { return vec<3,T>(-v.x, -v.y, -v.z); }
+template<typename T> constexpr vec<4,T> operator-(const vec<4,T>& v) { return vec<4,T>(-v.x, -v.y, -v.z, -v.w); }
+
+template <typename T> constexpr vec<3,T> cross(vec<3,T> v1, vec<3,T> v2) {
     return vec<3,T>(v1.y*v2.z - v1.z*v2.y, v1.z*v2.x - v1.x*v2.z, v1.x*v2.y - v1.y*v2.x);
 }
 
@@ -82,7 +120,7 @@ template <size_t DIM, typename T> std::ostream& operator<<(std::ostream& out, co
     return out ;
 }
 
-inline float dot(vec3f const& lhs, vec3f const& rhs)
+constexpr float dot(vec3f const& lhs, vec3f const& rhs)
 {
 	return lhs.x * rhs.x + lhs.y * rhs.y + lhs.z * rhs.z;
 }
@@ -92,7 +130,7 @@ inline float angle(vec3f const& lhs, vec3f const& rhs)
 	return dot(lhs, rhs) / (lhs.norm() * rhs.norm());
 }
 
-inline vec3f reflect(vec3f const& v, vec3f const& n)
+constexpr vec3f reflect(vec3f const& v, vec3f const& n)
 {
     return v - 2 * dot(v, n) * n;
 }
@@ -122,4 +160,180 @@ auto lerp(T from, T to, float t)
     return (1 - t) * from + t * to;
 }
 
+
+// wide (SoA) types, one lane per ray or primitive
+// wide_float<4> maps to SSE and wide_float<8> to AVX when available, any other width or target uses plain arrays
+
+template <size_t N> struct wide_mask {
+    bool lane[N];
+};
+
+template <size_t N> struct wide_float {
+    wide_float() : wide_float(0.0f) {}
+    wide_float(float s) { for (size_t i=N; i--; lane[i] = s); }
+    static wide_float load(const float* p) { wide_float r; for (size_t i=N; i--; r.lane[i] = p[i]); return r; }
+    void store(float* p) const { for (size_t i=N; i--; p[i] = lane[i]); }
+    float operator[](const size_t i) const { assert(i<N); return lane[i]; }
+    float lane[N];
+};
+
+template <size_t N> wide_float<N> operator+(wide_float<N> a, wide_float<N> const& b) { for (size_t i=N; i--; a.lane[i] += b.lane[i]); return a; }
+template <size_t N> wide_float<N> operator-(wide_float<N> a, wide_float<N> const& b) { for (size_t i=N; i--; a.lane[i] -= b.lane[i]); return a; }
+template <size_t N> wide_float<N> operator*(wide_float<N> a, wide_float<N> const& b) { for (size_t i=N; i--; a.lane[i] *= b.lane[i]); return a; }
+template <size_t N> wide_float<N> operator/(wide_float<N> a, wide_float<N> const& b) { for (size_t i=N; i--; a.lane[i] /= b.lane[i]); return a; }
+template <size_t N> wide_float<N> operator-(wide_float<N> a) { for (size_t i=N; i--; a.lane[i] = -a.lane[i]); return a; }
+template <size_t N> wide_float<N> min(wide_float<N> a, wide_float<N> const& b) { for (size_t i=N; i--; a.lane[i] = std::min(a.lane[i], b.lane[i])); return a; }
+template <size_t N> wide_float<N> max(wide_float<N> a, wide_float<N> const& b) { for (size_t i=N; i--; a.lane[i] = std::max(a.lane[i], b.lane[i])); return a; }
+template <size_t N> wide_float<N> sqrt(wide_float<N> a) { for (size_t i=N; i--; a.lane[i] = std::sqrt(a.lane[i])); return a; }
+template <size_t N> wide_float<N> abs(wide_float<N> a) { for (size_t i=N; i--; a.lane[i] = std::abs(a.lane[i])); return a; }
+
+template <size_t N> wide_mask<N> operator<(wide_float<N> const& a, wide_float<N> const& b) { wide_mask<N> m; for (size_t i=N; i--; m.lane[i] = a.lane[i] < b.lane[i]); return m; }
+template <size_t N> wide_mask<N> operator<=(wide_float<N> const& a, wide_float<N> const& b) { wide_mask<N> m; for (size_t i=N; i--; m.lane[i] = a.lane[i] <= b.lane[i]); return m; }
+template <size_t N> wide_mask<N> operator>(wide_float<N> const& a, wide_float<N> const& b) { return b < a; }
+template <size_t N> wide_mask<N> operator>=(wide_float<N> const& a, wide_float<N> const& b) { return b <= a; }
+template <size_t N> wide_mask<N> operator&(wide_mask<N> a, wide_mask<N> const& b) { for (size_t i=N; i--; a.lane[i] = a.lane[i] && b.lane[i]); return a; }
+template <size_t N> wide_mask<N> operator|(wide_mask<N> a, wide_mask<N> const& b) { for (size_t i=N; i--; a.lane[i] = a.lane[i] || b.lane[i]); return a; }
+template <size_t N> wide_mask<N> operator!(wide_mask<N> a) { for (size_t i=N; i--; a.lane[i] = !a.lane[i]); return a; }
+template <size_t N> unsigned bits(wide_mask<N> const& m) { unsigned r = 0; for (size_t i=N; i--; r |= unsigned(m.lane[i]) << i); return r; }
+template <size_t N> bool any(wide_mask<N> const& m) { return bits(m) != 0; }
+template <size_t N> bool all(wide_mask<N> const& m) { return bits(m) == (1u << N) - 1; }
+// per lane m ? a : b
+template <size_t N> wide_float<N> select(wide_mask<N> const& m, wide_float<N> a, wide_float<N> const& b) { for (size_t i=N; i--; a.lane[i] = m.lane[i] ? a.lane[i] : b.lane[i]); return a; }
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+
+template <> struct wide_mask<4> {
+    __m128 m;
+};
+
+template <> struct wide_float<4> {
+    wide_float() : v(_mm_setzero_ps()) {}
+    wide_float(float s) : v(_mm_set1_ps(s)) {}
+    wide_float(__m128 x) : v(x) {}
+    static wide_float load(const float* p) { return _mm_loadu_ps(p); }
+    void store(float* p) const { _mm_storeu_ps(p, v); }
+    float operator[](const size_t i) const { assert(i<4); alignas(16) float l[4]; _mm_store_ps(l, v); return l[i]; }
+    __m128 v;
+};
+
+inline wide_float<4> operator+(wide_float<4> const& a, wide_float<4> const& b) { return _mm_add_ps(a.v, b.v); }
+inline wide_float<4> operator-(wide_float<4> const& a, wide_float<4> const& b) { return _mm_sub_ps(a.v, b.v); }
+inline wide_float<4> operator*(wide_float<4> const& a, wide_float<4> const& b) { return _mm_mul_ps(a.v, b.v); }
+inline wide_float<4> operator/(wide_float<4> const& a, wide_float<4> const& b) { return _mm_div_ps(a.v, b.v); }
+inline wide_float<4> operator-(wide_float<4> const& a) { return _mm_xor_ps(a.v, _mm_set1_ps(-0.0f)); }
+inline wide_float<4> min(wide_float<4> const& a, wide_float<4> const& b) { return _mm_min_ps(a.v, b.v); }
+inline wide_float<4> max(wide_float<4> const& a, wide_float<4> const& b) { return _mm_max_ps(a.v, b.v); }
+inline wide_float<4> sqrt(wide_float<4> const& a) { return _mm_sqrt_ps(a.v); }
+inline wide_float<4> abs(wide_float<4> const& a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v); }
+
+inline wide_mask<4> operator<(wide_float<4> const& a, wide_float<4> const& b) { return { _mm_cmplt_ps(a.v, b.v) }; }
+inline wide_mask<4> operator<=(wide_float<4> const& a, wide_float<4> const& b) { return { _mm_cmple_ps(a.v, b.v) }; }
+inline wide_mask<4> operator>(wide_float<4> const& a, wide_float<4> const& b) { return { _mm_cmpgt_ps(a.v, b.v) }; }
+inline wide_mask<4> operator>=(wide_float<4> const& a, wide_float<4> const& b) { return { _mm_cmpge_ps(a.v, b.v) }; }
+inline wide_mask<4> operator&(wide_mask<4> const& a, wide_mask<4> const& b) { return { _mm_and_ps(a.m, b.m) }; }
+inline wide_mask<4> operator|(wide_mask<4> const& a, wide_mask<4> const& b) { return { _mm_or_ps(a.m, b.m) }; }
+inline wide_mask<4> operator!(wide_mask<4> const& a) { return { _mm_xor_ps(a.m, _mm_castsi128_ps(_mm_set1_epi32(-1))) }; }
+inline unsigned bits(wide_mask<4> const& m) { return static_cast<unsigned>(_mm_movemask_ps(m.m)); }
+inline bool any(wide_mask<4> const& m) { return bits(m) != 0; }
+inline bool all(wide_mask<4> const& m) { return bits(m) == 0xf; }
+inline wide_float<4> select(wide_mask<4> const& m, wide_float<4> const& a, wide_float<4> const& b) { return _mm_or_ps(_mm_and_ps(m.m, a.v), _mm_andnot_ps(m.m, b.v)); }
+#endif
+
+#if defined(__AVX__)
+#include <immintrin.h>
+
+template <> struct wide_mask<8> {
+    __m256 m;
+};
+
+template <> struct wide_float<8> {
+    wide_float() : v(_mm256_setzero_ps()) {}
+    wide_float(float s) : v(_mm256_set1_ps(s)) {}
+    wide_float(__m256 x) : v(x) {}
+    static wide_float load(const float* p) { return _mm256_loadu_ps(p); }
+    void store(float* p) const { _mm256_storeu_ps(p, v); }
+    float operator[](const size_t i) const { assert(i<8); alignas(32) float l[8]; _mm256_store_ps(l, v); return l[i]; }
+    __m256 v;
+};
+
+inline wide_float<8> operator+(wide_float<8> const& a, wide_float<8> const& b) { return _mm256_add_ps(a.v, b.v); }
+inline wide_float<8> operator-(wide_float<8> const& a, wide_float<8> const& b) { return _mm256_sub_ps(a.v, b.v); }
+inline wide_float<8> operator*(wide_float<8> const& a, wide_float<8> const& b) { return _mm256_mul_ps(a.v, b.v); }
+inline wide_float<8> operator/(wide_float<8> const& a, wide_float<8> const& b) { return _mm256_div_ps(a.v, b.v); }
+inline wide_float<8> operator-(wide_float<8> const& a) { return _mm256_xor_ps(a.v, _mm256_set1_ps(-0.0f)); }
+inline wide_float<8> min(wide_float<8> const& a, wide_float<8> const& b) { return _mm256_min_ps(a.v, b.v); }
+inline wide_float<8> max(wide_float<8> const& a, wide_float<8> const& b) { return _mm256_max_ps(a.v, b.v); }
+inline wide_float<8> sqrt(wide_float<8> const& a) { return _mm256_sqrt_ps(a.v); }
+inline wide_float<8> abs(wide_float<8> const& a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v); }
+
+inline wide_mask<8> operator<(wide_float<8> const& a, wide_float<8> const& b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; }
+inline wide_mask<8> operator<=(wide_float<8> const& a, wide_float<8> const& b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ) }; }
+inline wide_mask<8> operator>(wide_float<8> const& a, wide_float<8> const& b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ) }; }
+inline wide_mask<8> operator>=(wide_float<8> const& a, wide_float<8> const& b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ) }; }
+inline wide_mask<8> operator&(wide_mask<8> const& a, wide_mask<8> const& b) { return { _mm256_and_ps(a.m, b.m) }; }
+inline wide_mask<8> operator|(wide_mask<8> const& a, wide_mask<8> const& b) { return { _mm256_or_ps(a.m, b.m) }; }
+inline wide_mask<8> operator!(wide_mask<8> const& a) { return { _mm256_xor_ps(a.m, _mm256_castsi256_ps(_mm256_set1_epi32(-1))) }; }
+inline unsigned bits(wide_mask<8> const& m) { return static_cast<unsigned>(_mm256_movemask_ps(m.m)); }
+inline bool any(wide_mask<8> const& m) { return bits(m) != 0; }
+inline bool all(wide_mask<8> const& m) { return bits(m) == 0xff; }
+inline wide_float<8> select(wide_mask<8> const& m, wide_float<8> const& a, wide_float<8> const& b) { return _mm256_blendv_ps(b.v, a.v, m.m); }
+#endif
+
+typedef wide_float<4> float4w;
+typedef wide_float<8> float8w;
+
+// a vec3 of N lanes, stored as three wide registers
+template <typename F> struct vec3w {
+    vec3w() {}
+    vec3w(F X, F Y, F Z) : x(X), y(Y), z(Z) {}
+    vec3w(vec3f const& v) : x(v.x), y(v.y), z(v.z) {}
+    F norm() const { return sqrt(x * x + y * y + z * z); }
+    F norm2() const { return x * x + y * y + z * z; }
+    vec3w& normalize() { F const inv = F(1.0f) / norm(); x = x * inv; y = y * inv; z = z * inv; return *this; }
+    F x,y,z;
+};
+
+typedef vec3w<float4w> vec3f4;
+typedef vec3w<float8w> vec3f8;
+
+template <typename F> vec3w<F> operator+(vec3w<F> const& a, vec3w<F> const& b) { return vec3w<F>(a.x + b.x, a.y + b.y, a.z + b.z); }
+template <typename F> vec3w<F> operator-(vec3w<F> const& a, vec3w<F> const& b) { return vec3w<F>(a.x - b.x, a.y - b.y, a.z - b.z); }
+template <typename F> vec3w<F> operator-(vec3w<F> const& a) { return vec3w<F>(-a.x, -a.y, -a.z); }
+template <typename F> vec3w<F> operator*(vec3w<F> const& a, F const& s) { return vec3w<F>(a.x * s, a.y * s, a.z * s); }
+template <typename F> vec3w<F> operator*(F const& s, vec3w<F> const& a) { return a * s; }
+template <typename F> vec3w<F> operator*(vec3w<F> const& a, float s) { return a * F(s); }
+template <typename F> vec3w<F> operator*(float s, vec3w<F> const& a) { return a * F(s); }
+
+template <typename F> F dot(vec3w<F> const& a, vec3w<F> const& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+
+template <typename F> vec3w<F> cross(vec3w<F> const& a, vec3w<F> const& b) {
+    return vec3w<F>(a.y*b.z - a.z*b.y, a.z*b.x - a.x*b.z, a.x*b.y - a.y*b.x);
+}
+
+template <typename F> vec3w<F> normalize(vec3w<F> v) { return v.normalize(); }
+
+template <typename F> vec3w<F> reflect(vec3w<F> const& v, vec3w<F> const& n) { return v - n * (F(2.0f) * dot(v, n)); }
+
+// lane wise version of refract(), the branches become blends
+template <typename F> vec3w<F> refract(vec3w<F> const& v, vec3w<F> const& n, F const& refractive_index) {
+    F const c = min(F(1.0f), max(F(-1.0f), dot(v, n)));
+    auto const outside = c < F(0.0f);
+    F const cosi = abs(c);
+    F const eta = select(outside, F(1.0f) / refractive_index, refractive_index);
+    vec3w<F> const N = select(outside, n, -n);
+    F const k = F(1.0f) - eta * eta * (F(1.0f) - cosi * cosi);
+    vec3w<F> const r = v * eta + N * (eta * cosi - sqrt(max(k, F(0.0f))));
+    return select(k < F(0.0f), vec3w<F>(F(0.0f), F(0.0f), F(0.0f)), r);
+}
+
+template <typename F> vec3w<F> lerp(vec3w<F> const& from, vec3w<F> const& to, F const& t) { return from * (F(1.0f) - t) + to * t; }
+
+template <typename F, typename M> vec3w<F> select(M const& m, vec3w<F> const& a, vec3w<F> const& b) {
+    return vec3w<F>(select(m, a.x, b.x), select(m, a.y, b.y), select(m, a.z, b.z));
+}
+
+// lane i of a wide vec3
+template <typename F> vec3f extract(vec3w<F> const& v, size_t i) { return vec3f(v.x[i], v.y[i], v.z[i]); }
+
 #endif //__GEOMETRY_H__
\ No newline at end of file
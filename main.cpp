@@ -1,11 +1,35 @@
 #include <limits>
 
 #define _USE_MATH_DEFINES
+#include <cfloat>
 #include <cmath>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <map>
+#include <string>
 #include <vector>
 #include <algorithm>
+#include <memory>
 #include <optional>
+#include <sstream>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
 #include "geometry.h"
+#include "arena.h"
+#include "mapped_file.h"
+#include "net.h"
+#include "trace.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
@@ -28,32 +52,258 @@ namespace Color
 	const color white = { 1.0f, 1.0f, 1.0f, 1.0f };
 }
 
+// header of a decoded texture cache file, the texels follow at data_offset as packed float rgb in the tiled mip layout of texture
+struct texture_cache_header
+{
+	static constexpr char magic_value[4] = { 'T', 'R', 'T', 'X' };
+	static constexpr uint32_t current_version = 2;
+
+	char magic[4];
+	uint32_t version;
+	uint32_t width, height;
+	int64_t source_mtime;
+	uint64_t source_size;
+	uint64_t source_hash;	// FNV-1a of the source file bytes
+	uint64_t data_offset;	// page aligned so the texels can be used straight from the mapping
+};
+
+// rgb texture with its whole mip chain
+// every level is cut in 8x8 texel tiles stored one after the other, row of tiles by row of tiles, with the texels of a
+// tile in Morton order, so a bilinear footprint touches one or two cache lines and nearby lookups share pages
 struct texture
 {
-	int width, height;
-	std::vector<vec3f> data;
-	
+	struct mip_level
+	{
+		int width, height;
+		int tiles_x;
+		size_t offset;	// of its first texel in texels
+	};
+
+	static constexpr int tile_bits = 3;
+	static constexpr int tile_size = 1 << tile_bits;
+
+	int width = 0, height = 0;	// of level 0
+	int level_count = 0;
+	mip_level levels[32];
+	vec3f const* texels = nullptr;	// size() texels, pointing either in data or in the mapped cache file
+	std::pmr::vector<vec3f> data;
+	std::unique_ptr<mapped_file> cache;
+
+	// decoded textures are kept in <source path>.cache files that later loads map instead of decoding again
+	static inline bool use_cache = true;
+
+	explicit texture(std::pmr::memory_resource* mem = std::pmr::get_default_resource()) : data(mem) {}
+
+	// texels stored for all the levels, tile padding included
+	[[nodiscard]] size_t size() const noexcept
+	{
+		if (level_count == 0)
+			return 0;
+		mip_level const& last = levels[level_count - 1];
+		return last.offset + tile_size * tile_size;
+	}
+
+	[[nodiscard]] vec3f texel(int level, int x, int y) const noexcept
+	{
+		mip_level const& l = levels[level];
+		size_t const tile = static_cast<size_t>(y >> tile_bits) * l.tiles_x + (x >> tile_bits);
+		return texels[l.offset + (tile << (2 * tile_bits)) + morton(x & (tile_size - 1), y & (tile_size - 1))];
+	}
+
+	// trilinear lookup at u, v in [0, 1], u wraps around and v is clamped
+	// footprint is the extent of the lookup in level 0 texels, it picks the levels blended
+	[[nodiscard]] vec3f sample(float u, float v, float footprint) const noexcept
+	{
+		float const lod = std::clamp(std::log2(std::max(footprint, 1.0f)), 0.0f, static_cast<float>(level_count - 1));
+		int const l0 = static_cast<int>(lod);
+		int const l1 = std::min(l0 + 1, level_count - 1);
+		float const f = lod - l0;
+		vec3f const c0 = bilinear(l0, u, v);
+		return f > 0.0f ? c0 * (1.0f - f) + bilinear(l1, u, v) * f : c0;
+	}
+
 	void load(const char* path) noexcept
 	{
 		assert(path);
+		trace::scope const timed("texture load", "io");
+		std::string const cache_path = std::string(path) + ".cache";
+		texture_cache_header source;
+		bool const cacheable = use_cache && describe_source(path, source);
+		if (cacheable && load_cache(cache_path.c_str(), source))
+			return;
+
+		cache.reset();
 		int r = -1;
 		stbi_uc* pixmap = stbi_load(path, &width, &height, &r, 0);
 		if (!pixmap || r != 3)
+		{
 			std::cerr << "texture load error : " <<  r;
+			stbi_image_free(pixmap);
+			width = height = 0;
+			level_count = 0;
+			data.clear();
+			texels = nullptr;
+			return;
+		}
 		
-		data.resize(width * height);
-		for (int j = height - 1; j >= 0; j--) 
+		// each level is built row major from the previous one, then scattered into its tiles
+		std::vector<vec3f> level(static_cast<size_t>(width) * height);
+		for (size_t i = 0; i < level.size(); i++)
+			level[i] = vec3f(pixmap[i * 3 + 0], pixmap[i * 3 + 1], pixmap[i * 3 + 2]) * (1 / 255.);
+		stbi_image_free(pixmap);
+
+		layout();
+		data.assign(size(), vec3f(0, 0, 0));
+		for (int l = 0; ; l++)
+		{
+			mip_level const& m = levels[l];
+			for (int y = 0; y < m.height; y++)
+				for (int x = 0; x < m.width; x++)
+				{
+					size_t const tile = static_cast<size_t>(y >> tile_bits) * m.tiles_x + (x >> tile_bits);
+					data[m.offset + (tile << (2 * tile_bits)) + morton(x & (tile_size - 1), y & (tile_size - 1))] = level[static_cast<size_t>(y) * m.width + x];
+				}
+			if (l + 1 == level_count)
+				break;
+			level = downsample(level, m.width, m.height);
+		}
+		texels = data.data();
+
+		if (cacheable)
+			save_cache(cache_path, source);
+	}
+
+	private:
+
+	static_assert(sizeof(vec3f) == 3 * sizeof(float), "cache files store packed rgb floats");
+
+	// interleaves the bits of x and y, both below tile_size
+	[[nodiscard]] static constexpr size_t morton(int x, int y) noexcept
+	{
+		constexpr uint8_t spread[tile_size] = { 0, 1, 4, 5, 16, 17, 20, 21 };
+		return spread[x] | spread[y] << 1;
+	}
+
+	// levels from width x height down to 1x1 and where they start
+	void layout() noexcept
+	{
+		level_count = 0;
+		size_t offset = 0;
+		for (int w = width, h = height; ; w = std::max(1, w / 2), h = std::max(1, h / 2))
 		{
-			for (int i = 0; i < width; i++) 
+			int const tiles_x = (w + tile_size - 1) / tile_size;
+			int const tiles_y = (h + tile_size - 1) / tile_size;
+			levels[level_count++] = { w, h, tiles_x, offset };
+			offset += static_cast<size_t>(tiles_x) * tiles_y * tile_size * tile_size;
+			if (w == 1 && h == 1)
+				break;
+		}
+	}
+
+	// 2x2 box filter, an odd last row or column is folded into the one before
+	[[nodiscard]] static std::vector<vec3f> downsample(std::vector<vec3f> const& src, int w, int h)
+	{
+		int const dw = std::max(1, w / 2), dh = std::max(1, h / 2);
+		std::vector<vec3f> dst(static_cast<size_t>(dw) * dh);
+		for (int y = 0; y < dh; y++)
+			for (int x = 0; x < dw; x++)
 			{
-				data[i + j * width] = vec3f(pixmap[(i + j * width) * 3 + 0], 
-											pixmap[(i + j * width) * 3 + 1], 
-											pixmap[(i + j * width) * 3 + 2]) * (1 / 255.);
+				int const x0 = std::min(2 * x, w - 1), x1 = std::min(2 * x + 1, w - 1);
+				int const y0 = std::min(2 * y, h - 1), y1 = std::min(2 * y + 1, h - 1);
+				dst[static_cast<size_t>(y) * dw + x] = (src[static_cast<size_t>(y0) * w + x0] + src[static_cast<size_t>(y0) * w + x1]
+					+ src[static_cast<size_t>(y1) * w + x0] + src[static_cast<size_t>(y1) * w + x1]) * 0.25f;
 			}
+		return dst;
+	}
+
+	[[nodiscard]] vec3f bilinear(int level, float u, float v) const noexcept
+	{
+		mip_level const& l = levels[level];
+		float const x = u * l.width - 0.5f;
+		float const y = std::clamp(v * l.height - 0.5f, 0.0f, static_cast<float>(l.height - 1));
+		float const fx = std::floor(x), fy = std::floor(y);
+		float const ax = x - fx, ay = y - fy;
+		// wrap around horizontally, the modulo of a negative x is brought back positive
+		int const x0 = ((static_cast<int>(fx) % l.width) + l.width) % l.width;
+		int const x1 = x0 + 1 == l.width ? 0 : x0 + 1;
+		int const y0 = static_cast<int>(fy);
+		int const y1 = std::min(y0 + 1, l.height - 1);
+		return (texel(level, x0, y0) * (1.0f - ax) + texel(level, x1, y0) * ax) * (1.0f - ay)
+			+ (texel(level, x0, y1) * (1.0f - ax) + texel(level, x1, y1) * ax) * ay;
+	}
+
+	// fills the source identification part of a cache header
+	static bool describe_source(const char* path, texture_cache_header& h) noexcept
+	{
+		std::error_code ec;
+		auto const mtime = std::filesystem::last_write_time(path, ec);
+		auto const size = std::filesystem::file_size(path, ec);
+		if (ec)
+			return false;
+		std::ifstream in(path, std::ios::binary);
+		std::vector<char> bytes(size);
+		if (!in.read(bytes.data(), bytes.size()))
+			return false;
+		uint64_t hash = 0xcbf29ce484222325ull;
+		for (char c : bytes)
+			hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001b3ull;
+		h.source_mtime = static_cast<int64_t>(mtime.time_since_epoch().count());
+		h.source_size = bytes.size();
+		h.source_hash = hash;
+		return true;
+	}
+
+	bool load_cache(const char* cache_path, texture_cache_header const& source) noexcept
+	{
+		std::unique_ptr<mapped_file> file = mapped_file::open(cache_path);
+		if (!file || file->size() < sizeof(texture_cache_header))
+			return false;
+		texture_cache_header h;
+		std::memcpy(&h, file->data(), sizeof(h));
+		if (std::memcmp(h.magic, texture_cache_header::magic_value, 4) != 0 || h.version != texture_cache_header::current_version ||
+			h.source_mtime != source.source_mtime || h.source_size != source.source_size || h.source_hash != source.source_hash ||
+			h.width == 0 || h.height == 0 || h.width > (1u << 30) || h.height > (1u << 30))
+			return false;
+
+		width = static_cast<int>(h.width);
+		height = static_cast<int>(h.height);
+		layout();
+		size_t const texel_bytes = size() * sizeof(vec3f);
+		if (h.data_offset % alignof(vec3f) != 0 || file->size() < h.data_offset || file->size() - h.data_offset < texel_bytes)
+		{
+			width = height = level_count = 0;
+			return false;
 		}
-		stbi_image_free(pixmap);
+		data.clear();
+		texels = reinterpret_cast<vec3f const*>(file->data() + h.data_offset);
+		cache = std::move(file);
+		return true;
 	}
 
+	// written to a temporary file first so a concurrent reader never maps a partial cache
+	void save_cache(std::string const& cache_path, texture_cache_header h) const noexcept
+	{
+		std::memcpy(h.magic, texture_cache_header::magic_value, 4);
+		h.version = texture_cache_header::current_version;
+		h.width = static_cast<uint32_t>(width);
+		h.height = static_cast<uint32_t>(height);
+		h.data_offset = 4096;
+
+		std::string const tmp_path = cache_path + ".tmp";
+		{
+			std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+			std::vector<char> header(h.data_offset, 0);
+			std::memcpy(header.data(), &h, sizeof(h));
+			out.write(header.data(), header.size());
+			out.write(reinterpret_cast<char const*>(texels), size() * sizeof(vec3f));
+			if (!out)
+				return;
+		}
+		std::error_code ec;
+		std::filesystem::rename(tmp_path, cache_path, ec);
+		if (ec)
+			std::filesystem::remove(tmp_path, ec);
+	}
 };
 
 struct light
@@ -61,7 +311,147 @@ struct light
 	light(vec3f p, float in) noexcept : pos(p), intensity(in) {};
 	vec3f pos;
 	float intensity;
+	float radius = std::numeric_limits<float>::infinity(); // distance past which the light contributes nothing
 	static constexpr float ambient = 0.0;
+
+	// distance at which intensity / (1 + d^2) drops to cutoff, a cutoff of 0 means no falloff at all
+	[[nodiscard]] float influence_radius(float cutoff) const noexcept
+	{
+		if (cutoff <= 0.0f)
+			return std::numeric_limits<float>::infinity();
+		return std::sqrt(std::max(0.0f, intensity / cutoff - 1.0f));
+	}
+
+	// inverse square falloff windowed to reach exactly zero at radius
+	[[nodiscard]] float attenuation(float dist2) const noexcept
+	{
+		if (radius == std::numeric_limits<float>::infinity())
+			return 1.0f;
+		float const x = dist2 / (radius * radius);
+		float const window = std::max(0.0f, 1.0f - x * x);
+		return window * window / (1.0f + dist2);
+	}
+};
+
+enum class acceleration
+{
+	none,	// every ray is tested against every primitive
+	grid,	// spheres are found through a uniform_grid walked with a 3D-DDA, planes are still tested one by one
+};
+
+enum class light_sampling
+{
+	exhaustive,	// every light is shaded and shadow tested at every hit
+	tree,		// light_samples lights are picked per hit by walking a light_tree
+	grid,		// only the lights whose influence radius overlaps the hit, found through a light_grid
+};
+
+// binary tree over point lights, each node bounds its lights and sums their intensity
+// sampling descends it choosing children proportionally to a cheap importance estimate,
+// so picking one light costs O(log n) no matter how many lights the scene has
+struct light_tree
+{
+	struct node
+	{
+		vec3f bb_min, bb_max;
+		float intensity;
+		int first;	// interior: index of the left child (right is first+1), leaf: light index
+		bool leaf;
+	};
+
+	std::pmr::vector<node> nodes;
+
+	explicit light_tree(std::pmr::memory_resource* mem = std::pmr::get_default_resource()) : nodes(mem) {}
+
+	void build(std::pmr::vector<light> const& lights)
+	{
+		nodes.clear();
+		if (lights.empty())
+			return;
+		std::vector<int> ids(lights.size());
+		for (size_t i = 0; i < ids.size(); i++)
+			ids[i] = static_cast<int>(i);
+		nodes.reserve(lights.size() * 2 - 1);
+		nodes.emplace_back();
+		build_node(0, lights, ids.data(), ids.data() + ids.size());
+	}
+
+	// returns the picked light index and its selection probability, u is uniform in [0, 1)
+	[[nodiscard]] int sample(vec3f const& p, float u, float& pdf) const noexcept
+	{
+		assert(!nodes.empty());
+		pdf = 1.0f;
+		node const* n = &nodes[0];
+		while (!n->leaf)
+		{
+			node const& left = nodes[n->first];
+			node const& right = nodes[n->first + 1];
+			float const il = importance(left, p);
+			float const ir = importance(right, p);
+			float const pl = il + ir > 0.0f ? il / (il + ir) : 0.5f;
+			// reuse u for the next level by remapping the chosen sub-interval back to [0, 1)
+			if (u < pl)
+			{
+				u = std::min(u / pl, 0x1.fffffep-1f);
+				pdf *= pl;
+				n = &left;
+			}
+			else
+			{
+				u = std::min((u - pl) / (1.0f - pl), 0x1.fffffep-1f);
+				pdf *= 1.0f - pl;
+				n = &right;
+			}
+		}
+		return n->first;
+	}
+
+	private:
+
+	// intensity over squared distance to the node, clamped by the node size so that
+	// points inside or close to a cluster never starve any of its lights
+	[[nodiscard]] static float importance(node const& n, vec3f const& p) noexcept
+	{
+		vec3f const center = (n.bb_min + n.bb_max) * 0.5f;
+		float const radius2 = (n.bb_max - n.bb_min).norm2() * 0.25f;
+		return n.intensity / std::max({ (center - p).norm2(), radius2, 1e-4f });
+	}
+
+	void build_node(size_t index, std::pmr::vector<light> const& lights, int* begin, int* end)
+	{
+		node n;
+		n.bb_min = n.bb_max = lights[*begin].pos;
+		n.intensity = 0.0f;
+		for (int const* it = begin; it != end; ++it)
+		{
+			vec3f const& p = lights[*it].pos;
+			n.bb_min = vec3f(std::min(n.bb_min.x, p.x), std::min(n.bb_min.y, p.y), std::min(n.bb_min.z, p.z));
+			n.bb_max = vec3f(std::max(n.bb_max.x, p.x), std::max(n.bb_max.y, p.y), std::max(n.bb_max.z, p.z));
+			n.intensity += lights[*it].intensity;
+		}
+
+		if (end - begin == 1)
+		{
+			n.first = *begin;
+			n.leaf = true;
+			nodes[index] = n;
+			return;
+		}
+
+		// median split along the largest extent
+		vec3f const extent = n.bb_max - n.bb_min;
+		size_t const axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+		int* const mid = begin + (end - begin) / 2;
+		std::nth_element(begin, mid, end, [&](int a, int b) { return lights[a].pos[axis] < lights[b].pos[axis]; });
+
+		n.first = static_cast<int>(nodes.size());
+		n.leaf = false;
+		nodes[index] = n;
+		nodes.emplace_back();
+		nodes.emplace_back();
+		build_node(n.first, lights, begin, mid);
+		build_node(n.first + 1, lights, mid, end);
+	}
 };
 
 struct material
@@ -71,319 +461,3425 @@ struct material
 	float reflect = 0.0f;
 	float refraction_index = 0.0f;
 	float specular_exponent = 10.f;
+
+	bool operator==(material const& m) const noexcept
+	{
+		return col.x == m.col.x && col.y == m.col.y && col.z == m.col.z && col.w == m.col.w &&
+			ka == m.ka && kd == m.kd && ks == m.ks && kr == m.kr && reflect == m.reflect &&
+			refraction_index == m.refraction_index && specular_exponent == m.specular_exponent;
+	}
+};
+
+// pow(x, exponent) tabulated over the part of [0, 1] where it is visible, to keep pow out of the light loop
+// the table starts where the lobe drops below epsilon, so its resolution follows the lobe width
+// and the linear interpolation error stays around 1e-4 whatever the exponent
+struct specular_lobe
+{
+	static constexpr size_t size = 256;
+	static constexpr float epsilon = 1.0f / 1024.0f; // lobe values below this are returned as 0
+
+	explicit specular_lobe(float e) noexcept : exponent(e)
+	{
+		x_min = e > 0.0f ? std::pow(epsilon, 1.0f / e) : 0.0f;
+		scale = size / (1.0f - x_min);
+		for (size_t i = 0; i <= size; i++)
+			table[i] = std::pow(x_min + i / scale, e);
+	}
+
+	[[nodiscard]] float operator()(float x) const noexcept
+	{
+		if (x < x_min)
+			return 0.0f;
+		float const f = std::min((x - x_min) * scale, static_cast<float>(size));
+		size_t const i = std::min(static_cast<size_t>(f), size - 1);
+		return table[i] + (table[i + 1] - table[i]) * (f - i);
+	}
+
+	float exponent;
+	float x_min, scale;
+	float table[size + 1];
+};
+
+// the materials of a scene, deduplicated, stored SoA and referenced by primitives through a 16-bit index
+struct material_table
+{
+	std::pmr::vector<color> col;
+	std::pmr::vector<float> ka, kd, ks, kr;
+	std::pmr::vector<float> reflect;
+	std::pmr::vector<float> refraction_index;
+	std::pmr::vector<float> specular_exponent;
+	std::pmr::vector<uint16_t> lobe;		// index in lobes tabulating specular_exponent, filled by build_lobes()
+	std::pmr::vector<specular_lobe> lobes;
+
+	explicit material_table(std::pmr::memory_resource* mem = std::pmr::get_default_resource())
+	: col(mem), ka(mem), kd(mem), ks(mem), kr(mem), reflect(mem), refraction_index(mem), specular_exponent(mem), lobe(mem), lobes(mem),
+	index(mem) {}
+
+	// index of m, which is only added if no identical material exists yet, none once the 16-bit indices run out
+	[[nodiscard]] std::optional<uint16_t> add(material const& m)
+	{
+		auto const found = index.find(m);
+		if (found != index.end())
+			return found->second;
+		if (size() > std::numeric_limits<uint16_t>::max())
+			return {};
+		uint16_t const i = static_cast<uint16_t>(size());
+		index.emplace(m, i);
+		col.push_back(m.col);
+		ka.push_back(m.ka);
+		kd.push_back(m.kd);
+		ks.push_back(m.ks);
+		kr.push_back(m.kr);
+		reflect.push_back(m.reflect);
+		refraction_index.push_back(m.refraction_index);
+		specular_exponent.push_back(m.specular_exponent);
+		return i;
+	}
+
+	[[nodiscard]] material get(size_t i) const noexcept
+	{
+		return { col[i], ka[i], kd[i], ks[i], kr[i], reflect[i], refraction_index[i], specular_exponent[i] };
+	}
+
+	[[nodiscard]] size_t size() const noexcept { return col.size(); }
+
+	// one specular table per distinct exponent
+	void build_lobes()
+	{
+		lobes.clear();
+		lobe.resize(size());
+		for (size_t i = 0; i < size(); i++)
+		{
+			auto const it = std::find_if(lobes.begin(), lobes.end(), [&](specular_lobe const& l) { return l.exponent == specular_exponent[i]; });
+			lobe[i] = static_cast<uint16_t>(it - lobes.begin());
+			if (it == lobes.end())
+				lobes.emplace_back(specular_exponent[i]);
+		}
+	}
+
+	[[nodiscard]] float specular(uint16_t m, float x) const noexcept
+	{
+		return lobes[lobe[m]](x);
+	}
+
+	private:
+
+	// FNV-1a of the fields, with -0 hashed as 0 since they compare equal
+	struct material_hash
+	{
+		size_t operator()(material const& m) const noexcept
+		{
+			float const fields[] = { m.col.x, m.col.y, m.col.z, m.col.w, m.ka, m.kd, m.ks, m.kr, m.reflect, m.refraction_index, m.specular_exponent };
+			uint64_t hash = 0xcbf29ce484222325ull;
+			for (float f : fields)
+			{
+				uint32_t bits = 0;
+				if (f != 0.0f)
+					std::memcpy(&bits, &f, sizeof(bits));
+				hash = (hash ^ bits) * 0x100000001b3ull;
+			}
+			return static_cast<size_t>(hash);
+		}
+	};
+
+	std::pmr::unordered_map<material, uint16_t, material_hash> index;	// of every material in the table
 };
 
 struct hitInfo
 {
 	vec3f pos;
 	vec3f normal;
-	material mtrl;
+	uint16_t mtrl;	// index in the renderer material_table
+	float curvature = 0.0f;	// 1 / radius of the surface at pos, 0 where it is flat
+};
+
+// footprint of a ray, its width grows by spread per unit of distance and curved surfaces widen the spread
+// (Akenine-Moller et al. 2019, "Texture Level of Detail Strategies for Real-Time Ray Tracing")
+struct ray_cone
+{
+	float width = 0.0f;
+	float spread = 0.0f;	// radians
+
+	// the cone leaving a surface hit after distance, at grazing angles it covers more of the surface
+	[[nodiscard]] ray_cone bounce(float distance, float curvature, float cos_incidence) const noexcept
+	{
+		float const w = width + spread * distance;
+		return { w, spread + 2.0f * curvature * w / std::max(std::abs(cos_incidence), 0.05f) };
+	}
 };
 
-struct drawable
+// what a camera ray saw first, kept in the auxiliary buffers that guide the denoiser
+struct surface_sample
 {
-	material mtrl;
+	vec3f normal;	// zero where the ray escaped
+	float depth;	// distance along the ray, infinity where it escaped
+	color albedo;
 };
 
-struct sphere : drawable
+// what the grids need to know of a bounded primitive: its box and the radius of a sphere around the box center
+// that contains it too, cells are only assigned if they overlap both
+struct bounds
 {
-	vec3f pos;
+	vec3f lo, hi;
 	float radius;
 
-	sphere(vec3f const& p, float r, color const& c = Color::green) noexcept : drawable{ material{c} }, pos(p), radius(r) {}
-	sphere(vec3f const& p, float r, material const& m) noexcept : drawable{m}, pos(p), radius(r) {}
+	[[nodiscard]] vec3f center() const noexcept { return (lo + hi) * 0.5f; }
 
-	[[nodiscard]] std::optional<hitInfo> ray_intersect(vec3f const& origin, vec3f const& dir) const noexcept
-	{
-		hitInfo hinfo;
-		vec3f const f = origin - pos;
-		if (f.norm() < radius)
-			return {};
+	[[nodiscard]] static bounds of_sphere(vec3f const& c, float r) noexcept { return { c - vec3f(r, r, r), c + vec3f(r, r, r), r }; }
+	[[nodiscard]] static bounds of_box(vec3f const& lo, vec3f const& hi) noexcept { return { lo, hi, (hi - lo).norm() * 0.5f }; }
+};
+
+struct sphere
+{
+	vec4f geom;	// center in xyz, radius in w
+	uint16_t mtrl;
+
+	sphere(vec3f const& p, float r, uint16_t m) noexcept : geom(p.x, p.y, p.z, r), mtrl(m) {}
 
+	[[nodiscard]] vec3f center() const noexcept { return vec3f(geom.x, geom.y, geom.z); }
+	[[nodiscard]] float radius() const noexcept { return geom.w; }
+	[[nodiscard]] bounds bound() const noexcept { return bounds::of_sphere(center(), geom.w); }
+
+	// only the surface facing the ray counts, a ray starting inside the sphere passes through it
+	// true if it is hit within ]t_min, t_max[, t_max then becomes the hit distance
+	[[nodiscard]] bool ray_intersect(vec3f const& origin, vec3f const& dir, float t_min, float& t_max) const noexcept
+	{
+		vec3f const f = origin - center();
 		float const a = dot(dir, dir);
-		float const b = 2 * dot(dir, f);
-		float const c = dot(f, f) - radius * radius;
-		float const delta = b * b - 4 * a * c;
+		float const b = dot(dir, f);
+		float const c = dot(f, f) - geom.w * geom.w;
+		if (c < 0.0f)
+			return false;
+		float const delta = b * b - a * c;
 		if (delta <= 0.0f)
-			return {};
-		float const sdelta = sqrt(delta);
-		float t0 = (-b + sdelta) / 2.0f;
-		float t1 = (-b - sdelta) / 2.0f;
-		if (t0 > t1)
-			std::swap(t0, t1);
-		if (t0 < 0) {
-			t0 = t1; // if t0 is negative, let's use t1 instead 
-			if (t0 < 0) return {}; // both t0 and t1 are negative
-		}
-		float const t = t0;
-		hinfo.pos = origin + dir * t;
-		hinfo.normal = (hinfo.pos - pos).normalize();
-		hinfo.mtrl = mtrl;
-		return hinfo;
+			return false;
+		float const t = (-b - std::sqrt(delta)) / a;
+		if (t <= t_min || t >= t_max)
+			return false;
+		t_max = t;
+		return true;
+	}
+
+	[[nodiscard]] hitInfo hit(vec3f const& origin, vec3f const& dir, float t) const noexcept
+	{
+		vec3f const pos = origin + dir * t;
+		return { pos, (pos - center()).normalize(), mtrl, 1.0f / geom.w };
 	}
 };
 
-struct plan : drawable
+struct plan
 {
-	plan(vec3f const& p, vec3f const& n, material const& m) noexcept : drawable{m}, pos(p), normal(n) { }
+	plan(vec3f const& p, vec3f const& n, uint16_t m) noexcept : pos(p), normal(n), mtrl(m) { }
 
-	[[nodiscard]] std::optional<hitInfo> ray_intersect(vec3f const& origin, vec3f const& dir) const noexcept
+	// true if it is hit from the front within ]t_min, t_max[, t_max then becomes the hit distance
+	[[nodiscard]] bool ray_intersect(vec3f const& origin, vec3f const& dir, float t_min, float& t_max) const noexcept
 	{
 		float const d = dot(-normal, dir);
-		if (d > FLT_EPSILON)
-		{
-			vec3f const p = pos - origin;
-			float const t = dot(p, -normal) / d;
-			
-			if (t < 0)
-				return {};
-			
-			hitInfo result;
-			result.pos = origin + dir * t;
-			result.normal = normal;
-			result.mtrl = mtrl;
+		if (d <= FLT_EPSILON)
+			return false;
+		float const t = dot(pos - origin, -normal) / d;
+		if (t <= t_min || t >= t_max)
+			return false;
+		t_max = t;
+		return true;
+	}
 
-			return {result};
-		}
-		return {};
+	[[nodiscard]] hitInfo hit(vec3f const& origin, vec3f const& dir, float t) const noexcept
+	{
+		return { origin + dir * t, normal, mtrl };
 	}
 	
 	vec3f pos;
 	vec3f normal;
+	uint16_t mtrl;
 };
 
-class renderer
+// the kernels of the shapes below are written once against V = vec3f, F = float for one ray against one primitive,
+// and V = vec3f8, F = float8w for one ray against 8 primitives at once
+// they are branchless, return the entering distance if it lies within ]t_min, t_max[ and t_max otherwise,
+// a ray starting inside a closed shape passes through it, like for spheres
+
+// lanes of up to 8 shapes, the missing lanes repeat the first one
+template<typename S, typename B>
+float8w pack_lanes(S const* s, size_t n, float B::* f)
 {
-	public:
+	alignas(32) float l[8];
+	for (size_t i = 0; i < 8; i++)
+		l[i] = s[i < n ? i : 0].*f;
+	return float8w::load(l);
+}
 
-	renderer(size_t iwidth, size_t iheight, float ifov, const char* env_map_path) noexcept
-	: image(iwidth * iheight), width(iwidth), height(iheight), fov(ifov)
-	{
-		env_map.load(env_map_path);
-	}
+template<typename S, typename B>
+vec3f8 pack_lanes(S const* s, size_t n, vec3f B::* f)
+{
+	alignas(32) float l[3][8];
+	for (size_t i = 0; i < 8; i++)
+		for (size_t k = 0; k < 3; k++)
+			l[k][i] = (s[i < n ? i : 0].*f)[k];
+	return vec3f8(float8w::load(l[0]), float8w::load(l[1]), float8w::load(l[2]));
+}
+
+namespace shape_kernel
+{
+	// one lane versions of the wide operations, so that the kernels also compile with float and vec3f
+	// kept in here, next to std::min and friends they would be ambiguous
+	inline float min(float a, float b) noexcept { return a < b ? a : b; }
+	inline float max(float a, float b) noexcept { return a < b ? b : a; }
+	inline float select(bool m, float a, float b) noexcept { return m ? a : b; }
 
-	// return the closest hitpoint 
-	[[nodiscard]] std::optional<hitInfo> scene_intersect(vec3f const& origin, vec3f const& dir) noexcept
+	// oriented box, axis aligned when u, v, w are the world axes
+	template<typename V, typename F>
+	struct box_shape
 	{
-		std::optional<hitInfo> result;
-		float dist = std::numeric_limits<float>::max();
-		for (auto const& sphere : spheres)
+		V center;
+		V u, v, w;	// orthonormal
+		V half;		// half sizes along u, v and w
+
+		[[nodiscard]] F intersect(V const& o, V const& d, F t_min, F t_max) const noexcept
 		{
-			if (auto const hInfo = sphere.ray_intersect(origin, dir))
-			{
-				float const c_dist = (hInfo->pos - origin).norm2();
-				if (c_dist < dist)
-				{
-					dist = c_dist;
-					result = hInfo;
-				}
-			}
+			V const oc = o - center;
+			F const ou = dot(oc, u), ov = dot(oc, v), ow = dot(oc, w);
+			F const du = F(1.0f) / dot(d, u), dv = F(1.0f) / dot(d, v), dw = F(1.0f) / dot(d, w);
+			// slabs, a ray parallel to one gets infinite distances from the division
+			F const u0 = (-half.x - ou) * du, u1 = (half.x - ou) * du;
+			F const v0 = (-half.y - ov) * dv, v1 = (half.y - ov) * dv;
+			F const w0 = (-half.z - ow) * dw, w1 = (half.z - ow) * dw;
+			F const t_near = max(max(min(u0, u1), min(v0, v1)), min(w0, w1));
+			F const t_far = min(min(max(u0, u1), max(v0, v1)), max(w0, w1));
+			return select((t_near <= t_far) & (t_near > t_min) & (t_near < t_max), t_near, t_max);
 		}
-		
-		for (auto const& plan : plans)
+	};
+
+	// flat disc, seen from both sides
+	template<typename V, typename F>
+	struct disc_shape
+	{
+		V center;
+		V normal;
+		F radius;
+
+		[[nodiscard]] F intersect(V const& o, V const& d, F t_min, F t_max) const noexcept
 		{
-			if (auto const hInfo = plan.ray_intersect(origin, dir))
-			{
-				float const c_dist = (hInfo->pos - origin).norm2();
-				if (c_dist < dist)
-				{
-					dist = c_dist;
-					result = hInfo;
-				}
-			}
+			F const t = dot(center - o, normal) / dot(d, normal);
+			V const p = o + d * t - center;
+			return select((t > t_min) & (t < t_max) & (dot(p, p) <= radius * radius), t, t_max);
 		}
-		
-		return result;
-	}
-	 
-	[[nodiscard]] color cast_ray(vec3f const& origin, vec3f const& dir, unsigned depth = 0) noexcept
+	};
+
+	// parallelogram center +- a +- b, a rectangle when a and b are orthogonal, seen from both sides
+	template<typename V, typename F>
+	struct rectangle_shape
 	{
-		auto const hInfo = scene_intersect(origin, dir);
-		if (depth > max_depth || !hInfo)
-			return get_env_map_color(origin, dir);
-		
-		// reflection
-		color reflect_col = Color::none;
-		if (hInfo->mtrl.reflect > 0.0f)
+		V center;
+		V dual_a, dual_b;	// dual basis of the half edges, a point center + s a + t b has dot(p - center, dual_a) = s
+		V normal;
+
+		[[nodiscard]] F intersect(V const& o, V const& d, F t_min, F t_max) const noexcept
 		{
-			vec3f const r_dir = reflect(dir, hInfo->normal).normalize();
-			vec3f const r_origin = dot(r_dir, hInfo->normal) < 0 ? hInfo->pos - hInfo->normal * 1e-3 : hInfo->pos + hInfo->normal * 1e-3;
-			reflect_col = cast_ray(r_origin, r_dir, depth + 1);
+			F const t = dot(center - o, normal) / dot(d, normal);
+			V const p = o + d * t - center;
+			F const s = dot(p, dual_a), u = dot(p, dual_b);
+			return select((t > t_min) & (t < t_max) & (s * s <= F(1.0f)) & (u * u <= F(1.0f)), t, t_max);
 		}
+	};
 
-		// refraction
-		color refract_col = Color::none;
-		if (hInfo->mtrl.refraction_index > 0.0f)
+	// cylinder closed by two discs, center is halfway along the axis
+	template<typename V, typename F>
+	struct cylinder_shape
+	{
+		V center;
+		V axis;		// unit
+		F radius;
+		F half_height;
+
+		[[nodiscard]] F intersect(V const& o, V const& d, F t_min, F t_max) const noexcept
 		{
-			vec3f const r_dir = refract(dir, hInfo->normal, hInfo->mtrl.refraction_index).normalize();
-			vec3f const r_origin = dot(r_dir, hInfo->normal) < 0 ? hInfo->pos - hInfo->normal * 1e-3 : hInfo->pos + hInfo->normal * 1e-3;
-			refract_col = cast_ray(r_origin, r_dir, depth + 1);
+			V const oc = o - center;
+			F const oa = dot(oc, axis), da = dot(d, axis);
+			V const op = oc - axis * oa, dp = d - axis * da;
+			// side, the nearer root of the infinite cylinder, within the caps
+			F const a = dot(dp, dp), b = dot(dp, op), c = dot(op, op) - radius * radius;
+			F const delta = b * b - a * c;
+			F const ts = (-b - sqrt(max(delta, F(0.0f)))) / a;
+			F const hs = oa + da * ts;
+			auto const side = (delta > F(0.0f)) & (hs * hs <= half_height * half_height) & (ts > t_min) & (ts < t_max);
+			// the cap facing the ray
+			F const tc = (select(da < F(0.0f), half_height, -half_height) - oa) / da;
+			V const pc = op + dp * tc;
+			auto const cap = (dot(pc, pc) <= radius * radius) & (tc > t_min) & (tc < t_max);
+			return min(select(side, ts, t_max), select(cap, tc, t_max));
 		}
-		
-		float diffuse_light_intensity = 0, specular_light_intensity = 0;
-		for (auto const& light_it : lights)
-		{
-			vec3f const light_dir = (light_it.pos - hInfo->pos).normalize();
-			
-			// shadows
-			vec3f const shadow_start = dot(light_dir, hInfo->normal) < 0 ? hInfo->pos - hInfo->normal * 1e-3 : hInfo->pos + hInfo->normal * 1e-3;
-			if (auto const& shadow_hit = scene_intersect(shadow_start, light_dir))
-			{
-				if ((shadow_start - shadow_hit->pos).norm2() <= (shadow_start - light_it.pos).norm2())
-					continue;
-			}
-			
-			vec3f const R = reflect(-light_dir, hInfo->normal).normalize();
+	};
+}
 
-			diffuse_light_intensity += light_it.intensity * std::max(0.0f, dot(light_dir, hInfo->normal));
-			specular_light_intensity += light_it.intensity * std::pow(std::max(0.0f, dot(R, -dir)), hInfo->mtrl.specular_exponent);
-		}
-		return	hInfo->mtrl.col * hInfo->mtrl.ka * light::ambient +
-				hInfo->mtrl.col * diffuse_light_intensity * hInfo->mtrl.kd +
-				vec4f(1., 1., 1., 1.) * specular_light_intensity * hInfo->mtrl.ks + 
-				reflect_col * hInfo->mtrl.reflect + hInfo->mtrl.kr * refract_col;
+// the scalar primitives add a material, the hit data, bounds and the packing for the wide kernel
+
+struct box : shape_kernel::box_shape<vec3f, float>
+{
+	using wide = shape_kernel::box_shape<vec3f8, float8w>;
+	uint16_t mtrl;
+
+	// u and v are normalized and made orthogonal, w completes them
+	box(vec3f const& c, vec3f const& half_size, vec3f const& iu, vec3f const& iv, uint16_t m) noexcept
+	: mtrl(m)
+	{
+		vec3f const nu = vec3f(iu).normalize();
+		vec3f const nw = cross(nu, iv).normalize();
+		center = c;
+		u = nu;
+		v = cross(nw, nu);
+		w = nw;
+		half = half_size;
 	}
 
-	void init_scene() noexcept
+	[[nodiscard]] static box aligned(vec3f const& lo, vec3f const& hi, uint16_t m) noexcept
 	{
-		material const      ivory = { color{0.4f, 0.4f, 0.3f, 1.0f},	0.15, 0.6, 0.3, 0.0, 0.1, 1.0,50. };
-		material const      glass = { color{0.6,  0.7, 0.8, 1.0f},	0.15, 0.0, 0.5, 0.8, 0.0, 1.5,125. };
-		material const red_rubber = { color{0.3,  0.1, 0.1, 1.0f},	0.15, 0.9, 0.1, 0.0, 0.0, 1.0,10. };
-		material const blue_rubber = { color{0.1,  0.1, 0.6, 1.0f},	0.15, 0.9, 0.3, 0.0, 0.0, 1.0,10. };
-		material const yellow_rubber = { color{0.4,  0.4, 0.1, 1.0f}, 0.15, 0.9, 0.3, 0.0, 0.0, 1.0,10. };
-		material const     mirror = { color{ 1.0, 1.0, 1.0, 1.0f},	0.15, 0.0, 0.9, 0.0,0.8, 1.0,1425. };
-		spheres.emplace_back(vec3f(0, 8, -30), 8, mirror);
-		spheres.emplace_back(vec3f(7, 4, -18), 4, mirror);
-		spheres.emplace_back(vec3f(-3, -0.5, -16), 2, red_rubber);
-		spheres.emplace_back(vec3f(-1, -1.5, -12), 2, glass);
-		spheres.emplace_back(vec3f(1.5, -0.5, -20), 3, ivory);
-		spheres.emplace_back(vec3f(-14, -0.5, -20), 3, red_rubber);
-		//plans.emplace_back(vec3f(0, -10, 0), vec3f(0, 1, 0), blue_rubber);
+		return box((lo + hi) * 0.5f, (hi - lo) * 0.5f, vec3f(1, 0, 0), vec3f(0, 1, 0), m);
+	}
 
-		lights.emplace_back(vec3f(-20, 20, 20), 1.5);
-		lights.emplace_back(vec3f(30, 50, -25), 1.8);
-		lights.emplace_back(vec3f(0, 0, 0), 1.7);
+	[[nodiscard]] bool ray_intersect(vec3f const& origin, vec3f const& dir, float t_min, float& t_max) const noexcept
+	{
+		float const t = intersect(origin, dir, t_min, t_max);
+		if (!(t < t_max))
+			return false;
+		t_max = t;
+		return true;
 	}
 
-	void render() noexcept
+	[[nodiscard]] hitInfo hit(vec3f const& origin, vec3f const& dir, float t) const noexcept
 	{
-		float const tf2 = tanf(fov / 2.0f);
-		#pragma loop(hint_parallel(8))
-		for (size_t i = 0; i < height; i++)
-		{
-			for (size_t j = 0; j < width; j++)
-			{
-				for (unsigned m = 0; m < msaa; m++)
-				{
-					float const sample_offset = msaa > 1 ? static_cast<float>(m) / (msaa / 2) : 0.5f;
-					float const x = (2 * (j + sample_offset) / static_cast<float>(width) - 1) * tf2 * width / static_cast<float>(height);
-					float const y = -(2 * (i + sample_offset) / static_cast<float>(height) - 1) * tf2;
-					vec3f const dir = vec3f(x, y, -1).normalize();
-					image[j + i * width] = image[j + i * width] + cast_ray(vec3f(0, 0, 0), dir);
-				}
-				image[j + i * width].x /= static_cast<float>(msaa);
-				image[j + i * width].y /= static_cast<float>(msaa);
-				image[j + i * width].z /= static_cast<float>(msaa);
-				image[j + i * width].w /= static_cast<float>(msaa);
-			}
-		}
+		vec3f const pos = origin + dir * t;
+		vec3f const p = pos - center;
+		// the face is along the axis where the hit is relatively farthest out
+		float const lu = dot(p, u) / half.x, lv = dot(p, v) / half.y, lw = dot(p, w) / half.z;
+		vec3f normal = std::abs(lu) > std::abs(lv) && std::abs(lu) > std::abs(lw) ? u * lu
+			: std::abs(lv) > std::abs(lw) ? v * lv : w * lw;
+		return { pos, normal.normalize(), mtrl };
 	}
 
-	color get_env_map_color(vec3f origin, vec3f dir) const noexcept
+	[[nodiscard]] bounds bound() const noexcept
 	{
-		float const phi = atan2(dir.z, dir.x);
-		float const theta = acos(dir.y);
+		vec3f const e(std::abs(u.x) * half.x + std::abs(v.x) * half.y + std::abs(w.x) * half.z,
+			std::abs(u.y) * half.x + std::abs(v.y) * half.y + std::abs(w.y) * half.z,
+			std::abs(u.z) * half.x + std::abs(v.z) * half.y + std::abs(w.z) * half.z);
+		return { center - e, center + e, half.norm() };
+	}
 
-		size_t const x = env_map.width * (phi / M_PI + 1) / 2;
-		size_t const y = env_map.height * (theta / M_PI);
+	[[nodiscard]] static wide pack(box const* s, size_t n) noexcept
+	{
+		return { pack_lanes(s, n, &box::center), pack_lanes(s, n, &box::u), pack_lanes(s, n, &box::v),
+			pack_lanes(s, n, &box::w), pack_lanes(s, n, &box::half) };
+	}
+};
 
-		vec3f const col = env_map.data[std::clamp<size_t>(y * env_map.width + x, 0, env_map.data.size()-1)];
-		return color{ col.x, col.y, col.z, 1.0f };
+struct disc : shape_kernel::disc_shape<vec3f, float>
+{
+	using wide = shape_kernel::disc_shape<vec3f8, float8w>;
+	uint16_t mtrl;
+
+	disc(vec3f const& c, vec3f const& n, float r, uint16_t m) noexcept : mtrl(m)
+	{
+		center = c;
+		normal = vec3f(n).normalize();
+		radius = r;
 	}
 
-	void game_boy_pass() noexcept
+	[[nodiscard]] bool ray_intersect(vec3f const& origin, vec3f const& dir, float t_min, float& t_max) const noexcept
 	{
+		float const t = intersect(origin, dir, t_min, t_max);
+		if (!(t < t_max))
+			return false;
+		t_max = t;
+		return true;
+	}
+
+	// the normal faces the ray
+	[[nodiscard]] hitInfo hit(vec3f const& origin, vec3f const& dir, float t) const noexcept
+	{
+		return { origin + dir * t, dot(dir, normal) > 0.0f ? -normal : normal, mtrl };
+	}
+
+	[[nodiscard]] bounds bound() const noexcept
+	{
+		// extent of the disc along each world axis
+		vec3f const e(radius * std::sqrt(std::max(0.0f, 1.0f - normal.x * normal.x)),
+			radius * std::sqrt(std::max(0.0f, 1.0f - normal.y * normal.y)),
+			radius * std::sqrt(std::max(0.0f, 1.0f - normal.z * normal.z)));
+		return { center - e, center + e, radius };
+	}
+
+	[[nodiscard]] static wide pack(disc const* s, size_t n) noexcept
+	{
+		return { pack_lanes(s, n, &disc::center), pack_lanes(s, n, &disc::normal), pack_lanes(s, n, &disc::radius) };
+	}
+};
+
+struct rectangle : shape_kernel::rectangle_shape<vec3f, float>
+{
+	using wide = shape_kernel::rectangle_shape<vec3f8, float8w>;
+	vec3f a, b;		// half edges
+	uint16_t mtrl;
+
+	rectangle(vec3f const& c, vec3f const& half_a, vec3f const& half_b, uint16_t m) noexcept : a(half_a), b(half_b), mtrl(m)
+	{
+		center = c;
+		normal = cross(half_a, half_b).normalize();
+		// inverse of the gram matrix of a and b
+		float const aa = dot(a, a), ab = dot(a, b), bb = dot(b, b);
+		float const inv_det = 1.0f / (aa * bb - ab * ab);
+		dual_a = (a * bb - b * ab) * inv_det;
+		dual_b = (b * aa - a * ab) * inv_det;
+	}
+
+	[[nodiscard]] bool ray_intersect(vec3f const& origin, vec3f const& dir, float t_min, float& t_max) const noexcept
+	{
+		float const t = intersect(origin, dir, t_min, t_max);
+		if (!(t < t_max))
+			return false;
+		t_max = t;
+		return true;
+	}
+
+	// the normal faces the ray
+	[[nodiscard]] hitInfo hit(vec3f const& origin, vec3f const& dir, float t) const noexcept
+	{
+		return { origin + dir * t, dot(dir, normal) > 0.0f ? -normal : normal, mtrl };
+	}
+
+	[[nodiscard]] bounds bound() const noexcept
+	{
+		vec3f const e(std::abs(a.x) + std::abs(b.x), std::abs(a.y) + std::abs(b.y), std::abs(a.z) + std::abs(b.z));
+		return { center - e, center + e, std::max((a + b).norm(), (a - b).norm()) };
+	}
+
+	[[nodiscard]] static wide pack(rectangle const* s, size_t n) noexcept
+	{
+		return { pack_lanes(s, n, &rectangle::center), pack_lanes(s, n, &rectangle::dual_a), pack_lanes(s, n, &rectangle::dual_b),
+			pack_lanes(s, n, &rectangle::normal) };
+	}
+};
+
+struct cylinder : shape_kernel::cylinder_shape<vec3f, float>
+{
+	using wide = shape_kernel::cylinder_shape<vec3f8, float8w>;
+	uint16_t mtrl;
+
+	cylinder(vec3f const& c, vec3f const& ax, float r, float half_h, uint16_t m) noexcept : mtrl(m)
+	{
+		center = c;
+		axis = vec3f(ax).normalize();
+		radius = r;
+		half_height = half_h;
+	}
+
+	[[nodiscard]] bool ray_intersect(vec3f const& origin, vec3f const& dir, float t_min, float& t_max) const noexcept
+	{
+		float const t = intersect(origin, dir, t_min, t_max);
+		if (!(t < t_max))
+			return false;
+		t_max = t;
+		return true;
+	}
+
+	[[nodiscard]] hitInfo hit(vec3f const& origin, vec3f const& dir, float t) const noexcept
+	{
+		vec3f const pos = origin + dir * t;
+		vec3f const p = pos - center;
+		float const h = dot(p, axis);
+		vec3f radial = p - axis * h;
+		// whichever surface the hit is closest to
+		bool const on_cap = half_height - std::abs(h) < radius - radial.norm();
+		vec3f const normal = on_cap ? axis * (h < 0.0f ? -1.0f : 1.0f) : radial.normalize();
+		return { pos, normal, mtrl, on_cap ? 0.0f : 1.0f / radius };
+	}
+
+	[[nodiscard]] bounds bound() const noexcept
+	{
+		// the two cap discs and the axis between them
+		vec3f e;
+		for (size_t k = 0; k < 3; k++)
+			e[k] = std::abs(axis[k]) * half_height + radius * std::sqrt(std::max(0.0f, 1.0f - axis[k] * axis[k]));
+		return { center - e, center + e, std::sqrt(radius * radius + half_height * half_height) };
+	}
+
+	[[nodiscard]] static wide pack(cylinder const* s, size_t n) noexcept
+	{
+		return { pack_lanes(s, n, &cylinder::center), pack_lanes(s, n, &cylinder::axis), pack_lanes(s, n, &cylinder::radius),
+			pack_lanes(s, n, &cylinder::half_height) };
+	}
+};
+
+// every primitive of one bounded shape, and their lanes packed by 8 for the wide kernel
+template<typename Shape>
+struct shape_set
+{
+	std::pmr::vector<Shape> items;
+	std::pmr::vector<typename Shape::wide> packs;
+
+	explicit shape_set(std::pmr::memory_resource* mem = std::pmr::get_default_resource()) : items(mem), packs(mem) {}
+
+	void build_packs()
+	{
+		packs.clear();
+		packs.reserve((items.size() + 7) / 8);
+		for (size_t i = 0; i < items.size(); i += 8)
+			packs.push_back(Shape::pack(&items[i], std::min<size_t>(8, items.size() - i)));
+	}
+
+	// index of the closest item hit within ]t_min, t_max[ or -1, t_max becomes its distance
+	[[nodiscard]] int intersect(vec3f8 const& o, vec3f8 const& d, float t_min, float& t_max) const noexcept
+	{
+		int closest = -1;
+		float8w const t_min8(t_min);
+		for (size_t p = 0; p < packs.size(); p++)
+		{
+			float8w const t = packs[p].intersect(o, d, t_min8, float8w(t_max));
+			unsigned const hits = bits(t < float8w(t_max));
+			for (unsigned lane = 0; hits >> lane; lane++)
+			{
+				if ((hits >> lane & 1) && t[lane] < t_max)
+				{
+					t_max = t[lane];
+					closest = static_cast<int>(p * 8 + lane);
+				}
+			}
+		}
+		return closest;
+	}
+};
+
+struct render_stats
+{
+	uint64_t rays = 0;					// camera and secondary rays, shadow rays excluded
+	uint64_t shadow_rays = 0;
+	uint64_t shadow_cache_hits = 0;		// shadow rays resolved by the remembered occluder alone
+	uint64_t shadow_full_queries = 0;	// shadow rays that needed a scene wide occlusion query
+	uint64_t shadow_full_tests = 0;		// primitive tests done by those scene wide queries
+
+	render_stats& operator+=(render_stats const& rhs) noexcept
+	{
+		rays += rhs.rays;
+		shadow_rays += rhs.shadow_rays;
+		shadow_cache_hits += rhs.shadow_cache_hits;
+		shadow_full_queries += rhs.shadow_full_queries;
+		shadow_full_tests += rhs.shadow_full_tests;
+		return *this;
+	}
+
+	void print(std::ostream& out) const
+	{
+		double const hit_rate = shadow_rays ? 100.0 * shadow_cache_hits / shadow_rays : 0.0;
+		// each cache hit skips a full query, which would have cost about as much as the average one we did run
+		double const avg_full_tests = shadow_full_queries ? static_cast<double>(shadow_full_tests) / shadow_full_queries : 0.0;
+		double const saved_tests = shadow_cache_hits * std::max(0.0, avg_full_tests - 1.0);
+		out << "rays                 : " << rays << "\n"
+			<< "shadow rays          : " << shadow_rays << "\n"
+			<< "shadow cache hits    : " << shadow_cache_hits << " (" << hit_rate << "%)\n"
+			<< "full shadow queries  : " << shadow_full_queries << " (" << avg_full_tests << " tests avg)\n"
+			<< "tests saved (approx) : " << static_cast<uint64_t>(saved_tests) << "\n";
+	}
+};
+
+// quality render_within() delivered before its deadline
+struct frame_quality
+{
+	unsigned level = 0;				// step of the quality ladder reached, 0 is the coarsest
+	float resolution_scale = 1.0f;	// the image was traced at this fraction of its size and upsampled
+	unsigned spp = 1;
+	unsigned max_depth = 1;
+	float coverage = 1.0f;			// fraction of the pixels at this level, the rest kept the level below
+	double rays_per_second = 0.0;	// measured on the passes of this frame, shadow rays included
+	double seconds = 0.0;
+
+	void print(std::ostream& out) const
+	{
+		out << "quality level        : " << level << " (scale " << resolution_scale << ", spp " << spp
+			<< ", depth " << max_depth << ", " << coverage * 100.0f << "% of the pixels)\n"
+			<< "rays per second      : " << rays_per_second << "\n"
+			<< "frame time           : " << seconds * 1000.0 << " ms\n";
+	}
+};
+
+// counter based random numbers: every value is a hash of (frame, pixel, sample, dimension) so there is no state
+// to share between threads and an image doesn't depend on the thread count or the order tiles are rendered in
+struct sampler
+{
+	uint32_t key = 0;
+	uint32_t dimension = 0;
+
+	sampler() noexcept = default;
+	sampler(uint32_t frame, uint32_t pixel, uint32_t sample) noexcept
+	: key(hash(frame + hash(pixel + hash(sample))))
+	{
+	}
+
+	// pcg based integer hash, see "Hash Functions for GPU Rendering" (Jarzynski, Olano)
+	[[nodiscard]] static constexpr uint32_t hash(uint32_t v) noexcept
+	{
+		uint32_t const state = v * 747796405u + 2891336453u;
+		uint32_t const word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+		return (word >> 22u) ^ word;
+	}
+
+	// uniform in [0, 1), each call draws the next dimension
+	float random_float() noexcept
+	{
+		return (hash(key ^ hash(dimension++)) >> 8) * 0x1p-24f;
+	}
+};
+
+// scratch state owned by each rendering thread
+struct thread_state
+{
+	std::vector<int> last_occluder; // per light, id of the primitive that last blocked it or -1
+	render_stats stats;
+	sampler rng;	// reseeded for every camera sample
+};
+
+// uniform grid binning bounded items into cells, built in O(n)
+// cells are stored compressed: the items of cell c are items[cell_start[c] .. cell_start[c + 1]]
+struct uniform_grid
+{
+	vec3f origin;
+	vec3f cell_size;
+	int res[3] = { 0, 0, 0 };
+	std::pmr::vector<uint32_t> cell_start;
+	std::pmr::vector<uint32_t> items;
+
+	explicit uniform_grid(std::pmr::memory_resource* mem = std::pmr::get_default_resource()) : cell_start(mem), items(mem) {}
+
+	// bound(i, b) fills the bounds of item i and returns false to leave it out
+	// cells_per_item sets the grid density
+	template<typename Bound>
+	void build(size_t count, float cells_per_item, Bound&& bound)
+	{
+		cell_start.clear();
+		items.clear();
+		res[0] = res[1] = res[2] = 0;
+
+		vec3f bb_min(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+		vec3f bb_max = -bb_min;
+		size_t bounded = 0;
+		for (size_t i = 0; i < count; i++)
+		{
+			bounds b;
+			if (!bound(i, b))
+				continue;
+			for (size_t k = 0; k < 3; k++)
+			{
+				bb_min[k] = std::min(bb_min[k], b.lo[k]);
+				bb_max[k] = std::max(bb_max[k], b.hi[k]);
+			}
+			bounded++;
+		}
+		if (bounded == 0)
+			return;
+
+		// cubic-ish cells, never degenerate
+		vec3f const extent = bb_max - bb_min;
+		float const volume = std::max(extent.x, 1e-3f) * std::max(extent.y, 1e-3f) * std::max(extent.z, 1e-3f);
+		float const cell = std::cbrt(volume / (bounded * cells_per_item));
+		for (size_t k = 0; k < 3; k++)
+		{
+			res[k] = std::clamp(static_cast<int>(extent[k] / cell), 1, 256);
+			cell_size[k] = std::max(extent[k], 1e-3f) / res[k];
+		}
+		origin = bb_min;
+
+		// two passes: count the items per cell, then scatter them
+		size_t const cell_count = static_cast<size_t>(res[0]) * res[1] * res[2];
+		cell_start.assign(cell_count + 1, 0);
+		std::vector<uint32_t> cursor;
+		for (int pass = 0; pass < 2; pass++)
+		{
+			if (pass == 1)
+			{
+				for (size_t c = 0; c < cell_count; c++)
+					cell_start[c + 1] += cell_start[c];
+				items.resize(cell_start[cell_count]);
+				cursor.assign(cell_start.begin(), cell_start.end() - 1);
+			}
+			for (size_t i = 0; i < count; i++)
+			{
+				bounds b;
+				if (!bound(i, b))
+					continue;
+				vec3f const center = b.center();
+				float const radius = b.radius;
+				int lo[3], hi[3];
+				for (size_t k = 0; k < 3; k++)
+				{
+					lo[k] = cell_coord(b.lo[k], k);
+					hi[k] = cell_coord(b.hi[k], k);
+				}
+				for (int z = lo[2]; z <= hi[2]; z++)
+					for (int y = lo[1]; y <= hi[1]; y++)
+						for (int x = lo[0]; x <= hi[0]; x++)
+						{
+							// skip the cells the box reaches outside the bounding sphere
+							int const c[3] = { x, y, z };
+							vec3f nearest;
+							for (size_t k = 0; k < 3; k++)
+								nearest[k] = std::clamp(center[k], origin[k] + c[k] * cell_size[k], origin[k] + (c[k] + 1) * cell_size[k]);
+							if ((nearest - center).norm2() > radius * radius)
+								continue;
+							size_t const cell_id = (static_cast<size_t>(z) * res[1] + y) * res[0] + x;
+							if (pass == 0)
+								cell_start[cell_id + 1]++;
+							else
+								items[cursor[cell_id]++] = static_cast<uint32_t>(i);
+						}
+			}
+		}
+	}
+
+	// items of the cell containing p, an empty range if p is outside the grid
+	[[nodiscard]] std::pair<uint32_t const*, uint32_t const*> cell_items(vec3f const& p) const noexcept
+	{
+		if (cell_start.empty())
+			return { nullptr, nullptr };
+		for (size_t k = 0; k < 3; k++)
+			if (p[k] < origin[k] || p[k] > origin[k] + res[k] * cell_size[k])
+				return { nullptr, nullptr };
+		size_t const cell_id = (static_cast<size_t>(cell_coord(p.z, 2)) * res[1] + cell_coord(p.y, 1)) * res[0] + cell_coord(p.x, 0);
+		return { items.data() + cell_start[cell_id], items.data() + cell_start[cell_id + 1] };
+	}
+
+	// 3D-DDA walk of the cells pierced by origin + t * dir for t in [0, t_max], front to back
+	// visit(first, last, t_exit) gets the items of each cell and the t where the ray leaves it,
+	// it returns true to stop the walk
+	template<typename F>
+	void traverse(vec3f const& o, vec3f const& d, float t_max, F&& visit) const
+	{
+		if (cell_start.empty())
+			return;
+
+		float t0 = 0.0f, t1 = t_max;
+		for (size_t k = 0; k < 3; k++)
+		{
+			float const lo = origin[k], hi = origin[k] + res[k] * cell_size[k];
+			if (d[k] == 0.0f)
+			{
+				if (o[k] < lo || o[k] > hi)
+					return;
+				continue;
+			}
+			float ta = (lo - o[k]) / d[k];
+			float tb = (hi - o[k]) / d[k];
+			if (ta > tb)
+				std::swap(ta, tb);
+			t0 = std::max(t0, ta);
+			t1 = std::min(t1, tb);
+		}
+		if (t0 > t1)
+			return;
+
+		vec3f const entry = o + d * t0;
+		int cell[3], step[3];
+		float t_next[3], t_delta[3];
+		for (size_t k = 0; k < 3; k++)
+		{
+			cell[k] = cell_coord(entry[k], k);
+			if (d[k] > 0.0f)
+			{
+				step[k] = 1;
+				t_next[k] = (origin[k] + (cell[k] + 1) * cell_size[k] - o[k]) / d[k];
+				t_delta[k] = cell_size[k] / d[k];
+			}
+			else if (d[k] < 0.0f)
+			{
+				step[k] = -1;
+				t_next[k] = (origin[k] + cell[k] * cell_size[k] - o[k]) / d[k];
+				t_delta[k] = -cell_size[k] / d[k];
+			}
+			else
+			{
+				step[k] = 0;
+				t_next[k] = t_delta[k] = std::numeric_limits<float>::infinity();
+			}
+		}
+
+		while (true)
+		{
+			size_t const cell_id = (static_cast<size_t>(cell[2]) * res[1] + cell[1]) * res[0] + cell[0];
+			size_t const k = t_next[0] < t_next[1] ? (t_next[0] < t_next[2] ? 0 : 2) : (t_next[1] < t_next[2] ? 1 : 2);
+			float const t_exit = std::min(t_next[k], t1);
+			if (visit(items.data() + cell_start[cell_id], items.data() + cell_start[cell_id + 1], t_exit))
+				return;
+			if (t_next[k] >= t1)
+				return;
+			cell[k] += step[k];
+			if (cell[k] < 0 || cell[k] >= res[k])
+				return;
+			t_next[k] += t_delta[k];
+		}
+	}
+
+	private:
+
+	[[nodiscard]] int cell_coord(float v, size_t axis) const noexcept
+	{
+		return std::clamp(static_cast<int>((v - origin[axis]) / cell_size[axis]), 0, res[axis] - 1);
+	}
+};
+
+// lights binned by their influence sphere, each cell lists the lights that may reach it
+struct light_grid
+{
+	uniform_grid cells;
+	std::pmr::vector<uint32_t> unbounded;	// lights with an infinite radius, they reach every point
+
+	explicit light_grid(std::pmr::memory_resource* mem = std::pmr::get_default_resource()) : cells(mem), unbounded(mem) {}
+
+	void build(std::pmr::vector<light> const& lights)
+	{
+		unbounded.clear();
+		unbounded.reserve(std::count_if(lights.begin(), lights.end(), [](light const& l) { return l.radius == std::numeric_limits<float>::infinity(); }));
+		for (size_t i = 0; i < lights.size(); i++)
+			if (lights[i].radius == std::numeric_limits<float>::infinity())
+				unbounded.push_back(static_cast<uint32_t>(i));
+
+		cells.build(lights.size(), 1.0f, [&](size_t i, bounds& b)
+		{
+			b = bounds::of_sphere(lights[i].pos, lights[i].radius);
+			return lights[i].radius != std::numeric_limits<float>::infinity();
+		});
+	}
+
+	// calls f(light index) for every light that may reach p
+	template<typename F>
+	void for_each_light(vec3f const& p, F&& f) const
+	{
+		for (uint32_t id : unbounded)
+			f(id);
+		auto const [first, last] = cells.cell_items(p);
+		for (uint32_t const* it = first; it != last; ++it)
+			f(*it);
+	}
+};
+
+// a rectangle of pixels, [x0, x1) x [y0, y1)
+struct tile
+{
+	uint32_t x0, y0, x1, y1;
+};
+
+// order the pixels of a tile are rendered in, the curves keep consecutive rays close to each other in both directions
+// so they go through the same grid cells and texture tiles
+enum class pixel_order
+{
+	row_major,
+	morton,		// Z-order, cheapest to decode
+	hilbert,	// no jumps between consecutive pixels
+};
+
+// pixels a pass traces, those on a grid of step pixels minus the ones an earlier pass traced on a coarser grid
+struct pixel_grid
+{
+	uint32_t step = 1;
+	uint32_t traced_step = 0;	// 0 when nothing was traced before
+
+	[[nodiscard]] bool contains(size_t x, size_t y) const noexcept
+	{
+		return x % step == 0 && y % step == 0 && (traced_step == 0 || x % traced_step != 0 || y % traced_step != 0);
+	}
+};
+
+// position of the d-th point of the Z-order curve
+inline void morton_decode(uint32_t d, uint32_t& x, uint32_t& y) noexcept
+{
+	auto const compact = [](uint32_t v)
+	{
+		v &= 0x55555555u;
+		v = (v | (v >> 1)) & 0x33333333u;
+		v = (v | (v >> 2)) & 0x0f0f0f0fu;
+		v = (v | (v >> 4)) & 0x00ff00ffu;
+		return (v | (v >> 8)) & 0x0000ffffu;
+	};
+	x = compact(d);
+	y = compact(d >> 1);
+}
+
+// position of the d-th point of the Hilbert curve filling a side x side square, side a power of two
+inline void hilbert_decode(uint32_t side, uint32_t d, uint32_t& x, uint32_t& y) noexcept
+{
+	x = y = 0;
+	for (uint32_t s = 1; s < side; s *= 2)
+	{
+		uint32_t const rx = 1 & (d / 2);
+		uint32_t const ry = 1 & (d ^ rx);
+		if (ry == 0)
+		{
+			if (rx == 1)
+			{
+				x = s - 1 - x;
+				y = s - 1 - y;
+			}
+			std::swap(x, y);
+		}
+		x += s * rx;
+		y += s * ry;
+		d /= 4;
+	}
+}
+
+// what renderer::generate_scene() builds, the same parameters always give the same scene
+struct scene_params
+{
+	size_t spheres = 1000;
+	// mean radius, 0 keeps about the same coverage whatever the count
+	float radius = 0.0f;
+	// largest over smallest radius, and how sizes spread between them: 1 evenly, higher makes small spheres more common
+	float size_range = 3.0f;
+	float size_power = 1.0f;
+	// 0 spreads the spheres uniformly, otherwise they gather in that many gaussian blobs of cluster_spread deviation
+	size_t clusters = 0;
+	float cluster_spread = 3.0f;
+	// fractions of mirror and glass spheres, the rest are diffuse
+	float mirrors = 0.1f;
+	float glass = 0.1f;
+	size_t lights = 3;
+	// up to 5, floor, back, left and right walls then ceiling of a room around the spheres
+	size_t plans = 0;
+	uint32_t seed = 1;
+};
+
+class renderer
+{
+	public:
+
+	using clock = std::chrono::steady_clock;
+
+	renderer(size_t iwidth, size_t iheight, float ifov, const char* env_map_path) noexcept
+	: image(iwidth * iheight), width(iwidth), height(iheight), fov(ifov)
+	{
+		env_map.load(env_map_path);
+	}
+
+	// nothing is loaded, see load_async()
+	renderer(size_t iwidth, size_t iheight, float ifov) noexcept
+	: image(iwidth * iheight), width(iwidth), height(iheight), fov(ifov)
+	{
+	}
+
+	// decodes the environment map while the scene is parsed (init_scene() if scene_path is empty)
+	// and its acceleration structures built, rendering waits for both
+	void load_async(const char* env_map_path, std::string const& scene_path = {})
+	{
+		wait_loaded();
+		env_loading = std::async(std::launch::async, [this, path = std::string(env_map_path)]
+		{
+			env_map.load(path.c_str());
+		});
+		scene_loading = std::async(std::launch::async, [this, scene_path]
+		{
+			bool ok = true;
+			if (scene_path.empty())
+				ok = init_scene();
+			else
+			{
+				std::ifstream file(scene_path);
+				ok = file && load_scene(file);
+			}
+			build_acceleration();
+			return ok;
+		});
+	}
+
+	// blocks until the last load_async() is done, false if its scene couldn't be loaded
+	bool wait_loaded()
+	{
+		bool ok = true;
+		if (scene_loading.valid())
+			ok = scene_loading.get();
+		if (env_loading.valid())
+			env_loading.get();
+		return ok;
+	}
+
+	// drops every primitive, light, material, acceleration structure and the environment map at once
+	// the scene memory is kept (and grown to fit the previous scene if it overflowed) for the next one
+	void clear_scene() noexcept
+	{
+		wait_loaded();
+		env_map = texture(&scene_memory);
+		materials = material_table(&scene_memory);
+		plans = std::pmr::vector<plan>(&scene_memory);
+		spheres = std::pmr::vector<sphere>(&scene_memory);
+		boxes = shape_set<box>(&scene_memory);
+		discs = shape_set<disc>(&scene_memory);
+		rectangles = shape_set<rectangle>(&scene_memory);
+		cylinders = shape_set<cylinder>(&scene_memory);
+		lights = std::pmr::vector<light>(&scene_memory);
+		light_bvh = light_tree(&scene_memory);
+		light_cells = light_grid(&scene_memory);
+		primitive_cells = uniform_grid(&scene_memory);
+		scene_memory.release();
+		scene_dirty = true;
+	}
+
+	void load_env_map(const char* path) noexcept
+	{
+		env_map.load(path);
+	}
+
+	[[nodiscard]] scene_arena const& scene_allocator() const noexcept { return scene_memory; }
+
+	// return the closest hitpoint within ]t_min, t_max[
+	[[nodiscard]] std::optional<hitInfo> scene_intersect(vec3f const& origin, vec3f const& dir,
+		float t_min = 0.0f, float t_max = std::numeric_limits<float>::max()) noexcept
+	{
+		tls.stats.rays++;
+		// candidates only shrink t_max, the hit data is computed once for the closest
+		size_t constexpr no_hit = std::numeric_limits<size_t>::max();
+		size_t hit_id = no_hit;
+		size_t const bounded = bounded_count();
+
+		if (accel == acceleration::grid)
+		{
+			primitive_cells.traverse(origin, dir, t_max, [&](uint32_t const* first, uint32_t const* last, float t_exit)
+			{
+				for (; first != last; ++first)
+					if (primitive_intersects(*first, origin, dir, t_min, t_max))
+						hit_id = *first;
+				// a hit inside this cell can't be beaten by anything in the cells behind it
+				return hit_id != no_hit && t_max <= t_exit;
+			});
+		}
+		else
+		{
+			for (size_t i = 0; i < spheres.size(); i++)
+				if (spheres[i].ray_intersect(origin, dir, t_min, t_max))
+					hit_id = i;
+			// the other bounded shapes 8 at a time
+			if (bounded > spheres.size())
+			{
+				vec3f8 const o8(origin), d8(dir);
+				size_t offset = spheres.size();
+				for_each_shape_set([&](auto const& set)
+				{
+					int const i = set.intersect(o8, d8, t_min, t_max);
+					if (i >= 0)
+						hit_id = offset + static_cast<size_t>(i);
+					offset += set.items.size();
+				});
+			}
+		}
+		
+		for (size_t i = 0; i < plans.size(); i++)
+			if (plans[i].ray_intersect(origin, dir, t_min, t_max))
+				hit_id = bounded + i;
+		
+		if (hit_id == no_hit)
+			return std::nullopt;
+		hitInfo hit;
+		visit_primitive(hit_id, [&](auto const& primitive)
+		{
+			hit = primitive.hit(origin, dir, t_max);
+			return true;
+		});
+		return hit;
+	}
+
+	// true if something lies along dir within ]t_min, t_max[
+	// the last primitive that blocked light_id on this thread is tested first
+	[[nodiscard]] bool scene_occluded(vec3f const& origin, vec3f const& dir, float t_min, float t_max, size_t light_id) noexcept
+	{
+		tls.stats.shadow_rays++;
+		// render_tiles sizes it per frame, direct callers may come first or after lights were added
+		if (light_id >= tls.last_occluder.size())
+			tls.last_occluder.resize(light_id + 1, -1);
+		int& cached = tls.last_occluder[light_id];
+		if (cached >= 0 && primitive_occludes(cached, origin, dir, t_min, t_max))
+		{
+			tls.stats.shadow_cache_hits++;
+			return true;
+		}
+
+		tls.stats.shadow_full_queries++;
+		auto const occludes = [&](int id)
+		{
+			if (id == cached)
+				return false;
+			tls.stats.shadow_full_tests++;
+			if (!primitive_occludes(id, origin, dir, t_min, t_max))
+				return false;
+			cached = id;
+			return true;
+		};
+
+		int const bounded = static_cast<int>(bounded_count());
+		if (accel == acceleration::grid)
+		{
+			bool occluded = false;
+			primitive_cells.traverse(origin, dir, t_max, [&](uint32_t const* first, uint32_t const* last, float)
+			{
+				for (; first != last && !occluded; ++first)
+					occluded = occludes(static_cast<int>(*first));
+				return occluded;
+			});
+			if (occluded)
+				return true;
+		}
+		else
+		{
+			for (int id = 0; id < static_cast<int>(spheres.size()); id++)
+				if (occludes(id))
+					return true;
+			// the other bounded shapes 8 at a time
+			if (bounded > static_cast<int>(spheres.size()))
+			{
+				vec3f8 const o8(origin), d8(dir);
+				int offset = static_cast<int>(spheres.size());
+				int hit = -1;
+				for_each_shape_set([&](auto const& set)
+				{
+					if (hit < 0)
+					{
+						float t = t_max;
+						int const i = set.intersect(o8, d8, t_min, t);
+						tls.stats.shadow_full_tests += set.items.size();
+						if (i >= 0)
+							hit = offset + i;
+					}
+					offset += static_cast<int>(set.items.size());
+				});
+				if (hit >= 0)
+				{
+					cached = hit;
+					return true;
+				}
+			}
+		}
+
+		for (int id = bounded; id < bounded + static_cast<int>(plans.size()); id++)
+			if (occludes(id))
+				return true;
+		cached = -1;
+		return false;
+	}
+	 
+	// first_hit, if given, receives what the ray hit before any bounce
+	// t_min skips the surface a secondary ray starts on, cone picks the environment map mip level
+	[[nodiscard]] color cast_ray(vec3f const& origin, vec3f const& dir, unsigned depth = 0, surface_sample* first_hit = nullptr,
+		float t_min = 0.0f, ray_cone cone = {}) noexcept
+	{
+		auto const hInfo = scene_intersect(origin, dir, t_min);
+		if (depth > max_depth || !hInfo)
+		{
+			color const env = get_env_map_color(dir, cone.spread);
+			if (first_hit)
+				*first_hit = { vec3f(0, 0, 0), std::numeric_limits<float>::infinity(), env };
+			return env;
+		}
+		
+		uint16_t const m = hInfo->mtrl;
+		float const dist = (hInfo->pos - origin).norm();
+		ray_cone const bounced = cone.bounce(dist, hInfo->curvature, dot(dir, hInfo->normal));
+		// mirrors and glass see the albedo of what they reflect, so the denoiser keeps the reflected edges
+		surface_sample reflect_surface = { vec3f(0, 0, 0), 0.0f, Color::none };
+		surface_sample refract_surface = reflect_surface;
+
+		// reflection
+		color reflect_col = Color::none;
+		if (materials.reflect[m] > 0.0f)
+		{
+			vec3f const r_dir = reflect(dir, hInfo->normal).normalize();
+			reflect_col = cast_ray(hInfo->pos, r_dir, depth + 1, first_hit ? &reflect_surface : nullptr, ray_epsilon, bounced);
+		}
+
+		// refraction
+		color refract_col = Color::none;
+		if (materials.refraction_index[m] > 0.0f)
+		{
+			vec3f const r_dir = refract(dir, hInfo->normal, materials.refraction_index[m]).normalize();
+			refract_col = cast_ray(hInfo->pos, r_dir, depth + 1, first_hit ? &refract_surface : nullptr, ray_epsilon, bounced);
+		}
+		if (first_hit)
+			*first_hit = { hInfo->normal, dist,
+				materials.col[m] + reflect_surface.albedo * materials.reflect[m] + refract_surface.albedo * materials.kr[m] };
+		
+		float diffuse_light_intensity = 0, specular_light_intensity = 0;
+		if (light_mode == light_sampling::tree && !light_bvh.nodes.empty())
+		{
+			// one sample estimate per pick, weighted by the inverse of its selection probability
+			float const weight = 1.0f / static_cast<float>(light_samples);
+			for (unsigned s = 0; s < light_samples; s++)
+			{
+				float pdf;
+				int const light_id = light_bvh.sample(hInfo->pos, tls.rng.random_float(), pdf);
+				shade_light(light_id, *hInfo, dir, weight / pdf, diffuse_light_intensity, specular_light_intensity);
+			}
+		}
+		else if (light_mode == light_sampling::grid)
+		{
+			vec3f const p = hInfo->pos;
+			light_cells.for_each_light(p, [&](uint32_t light_id)
+			{
+				if ((lights[light_id].pos - p).norm2() < lights[light_id].radius * lights[light_id].radius)
+					shade_light(light_id, *hInfo, dir, 1.0f, diffuse_light_intensity, specular_light_intensity);
+			});
+		}
+		else
+		{
+			for (size_t light_id = 0; light_id < lights.size(); light_id++)
+				shade_light(light_id, *hInfo, dir, 1.0f, diffuse_light_intensity, specular_light_intensity);
+		}
+		return	materials.col[m] * materials.ka[m] * light::ambient +
+				materials.col[m] * diffuse_light_intensity * materials.kd[m] +
+				vec4f(1., 1., 1., 1.) * specular_light_intensity * materials.ks[m] + 
+				reflect_col * materials.reflect[m] + materials.kr[m] * refract_col;
+	}
+
+	// the init functions return false if their materials don't fit in the material table
+	bool init_scene() noexcept
+	{
+		uint16_t ids[4];
+		if (!add_materials({
+			{ color{0.4f, 0.4f, 0.3f, 1.0f},	0.15, 0.6, 0.3, 0.0, 0.1, 1.0,50. },
+			{ color{0.6,  0.7, 0.8, 1.0f},	0.15, 0.0, 0.5, 0.8, 0.0, 1.5,125. },
+			{ color{0.3,  0.1, 0.1, 1.0f},	0.15, 0.9, 0.1, 0.0, 0.0, 1.0,10. },
+			//{ color{0.1,  0.1, 0.6, 1.0f},	0.15, 0.9, 0.3, 0.0, 0.0, 1.0,10. },
+			//{ color{0.4,  0.4, 0.1, 1.0f}, 0.15, 0.9, 0.3, 0.0, 0.0, 1.0,10. },
+			{ color{ 1.0, 1.0, 1.0, 1.0f},	0.15, 0.0, 0.9, 0.0,0.8, 1.0,1425. } }, ids))
+			return false;
+		auto const [ivory, glass, red_rubber, mirror] = ids;
+		spheres.reserve(spheres.size() + 6);
+		lights.reserve(lights.size() + 3);
+		spheres.emplace_back(vec3f(0, 8, -30), 8, mirror);
+		spheres.emplace_back(vec3f(7, 4, -18), 4, mirror);
+		spheres.emplace_back(vec3f(-3, -0.5, -16), 2, red_rubber);
+		spheres.emplace_back(vec3f(-1, -1.5, -12), 2, glass);
+		spheres.emplace_back(vec3f(1.5, -0.5, -20), 3, ivory);
+		spheres.emplace_back(vec3f(-14, -0.5, -20), 3, red_rubber);
+		//plans.emplace_back(vec3f(0, -10, 0), vec3f(0, 1, 0), blue_rubber);
+
+		lights.emplace_back(vec3f(-20, 20, 20), 1.5);
+		lights.emplace_back(vec3f(30, 50, -25), 1.8);
+		lights.emplace_back(vec3f(0, 0, 0), 1.7);
+		scene_dirty = true;
+		return true;
+	}
+
+	// count similar sized spheres spread uniformly in a box in front of the camera, lit by the init_scene lights
+	bool init_particles(size_t count, uint32_t seed) noexcept
+	{
+		uint16_t ids[2];
+		if (!add_materials({
+			{ color{0.4f, 0.4f, 0.3f, 1.0f},	0.15, 0.6, 0.3, 0.0, 0.1, 1.0,50. },
+			{ color{0.3,  0.1, 0.1, 1.0f},	0.15, 0.9, 0.1, 0.0, 0.0, 1.0,10. } }, ids))
+			return false;
+		auto const [ivory, red_rubber] = ids;
+		sampler gen(seed, 0, 0);
+		// keep roughly the same coverage whatever the count
+		float const radius = 12.0f / std::cbrt(static_cast<float>(std::max<size_t>(count, 1)));
+		spheres.reserve(spheres.size() + count);
+		lights.reserve(lights.size() + 3);
+		for (size_t i = 0; i < count; i++)
+		{
+			vec3f const p(gen.random_float() * 40 - 20, gen.random_float() * 24 - 12, -15 - gen.random_float() * 30);
+			spheres.emplace_back(p, radius * (0.5f + gen.random_float()), i % 2 ? ivory : red_rubber);
+		}
+
+		lights.emplace_back(vec3f(-20, 20, 20), 1.5);
+		lights.emplace_back(vec3f(30, 50, -25), 1.8);
+		lights.emplace_back(vec3f(0, 0, 0), 1.7);
+		scene_dirty = true;
+		return true;
+	}
+
+	// stress scene for scaling studies, spheres fill the same box in front of the camera as init_particles
+	bool generate_scene(scene_params const& p) noexcept
+	{
+		uint16_t ids[6];
+		if (!add_materials({
+			{ color{0.4f, 0.4f, 0.3f, 1.0f},	0.15, 0.6, 0.3, 0.0, 0.1, 1.0,50. },
+			{ color{0.3,  0.1, 0.1, 1.0f},	0.15, 0.9, 0.1, 0.0, 0.0, 1.0,10. },
+			{ color{0.1,  0.1, 0.6, 1.0f},	0.15, 0.9, 0.3, 0.0, 0.0, 1.0,10. },
+			{ color{0.4,  0.4, 0.1, 1.0f},	0.15, 0.9, 0.3, 0.0, 0.0, 1.0,10. },
+			{ color{0.6,  0.7, 0.8, 1.0f},	0.15, 0.0, 0.5, 0.8, 0.0, 1.5,125. },
+			{ color{ 1.0, 1.0, 1.0, 1.0f},	0.15, 0.0, 0.9, 0.0,0.8, 1.0,1425. } }, ids))
+			return false;
+		uint16_t const diffuse[] = { ids[0], ids[1], ids[2], ids[3] };
+		uint16_t const glass = ids[4], mirror = ids[5];
+		vec3f const lo(-20, -12, -45), size(40, 24, 30);
+
+		sampler gen(p.seed, 0, 0);
+		auto const in_box = [&] { return vec3f(lo.x + gen.random_float() * size.x, lo.y + gen.random_float() * size.y, lo.z + gen.random_float() * size.z); };
+		auto const gaussian = [&]
+		{
+			float const r = std::sqrt(-2.0f * std::log(std::max(gen.random_float(), 1e-7f)));
+			float const a = 2.0f * static_cast<float>(M_PI) * gen.random_float();
+			return r * std::cos(a);
+		};
+		std::vector<vec3f> centers(p.clusters);
+		for (vec3f& c : centers)
+			c = in_box();
+
+		float const radius = p.radius > 0.0f ? p.radius : 12.0f / std::cbrt(static_cast<float>(std::max<size_t>(p.spheres, 1)));
+		float const smallest = 2.0f * radius / (1.0f + p.size_range);
+		spheres.reserve(spheres.size() + p.spheres);
+		for (size_t i = 0; i < p.spheres; i++)
+		{
+			vec3f pos = in_box();
+			if (!centers.empty())
+			{
+				vec3f const& c = centers[std::min(static_cast<size_t>(gen.random_float() * centers.size()), centers.size() - 1)];
+				pos = c + vec3f(gaussian(), gaussian(), gaussian()) * p.cluster_spread;
+			}
+			float const r = smallest * (1.0f + (p.size_range - 1.0f) * std::pow(gen.random_float(), p.size_power));
+			float const kind = gen.random_float();
+			uint16_t const m = kind < p.mirrors ? mirror : kind < p.mirrors + p.glass ? glass : diffuse[i % std::size(diffuse)];
+			spheres.emplace_back(pos, r, m);
+		}
+
+		// the room, a little away from the box so that spheres don't cut through it
+		vec3f const hi = lo + size;
+		std::pair<vec3f, vec3f> const walls[] = {
+			{ vec3f(0, lo.y - 2, 0), vec3f(0, 1, 0) },
+			{ vec3f(0, 0, lo.z - 10), vec3f(0, 0, 1) },
+			{ vec3f(lo.x - 10, 0, 0), vec3f(1, 0, 0) },
+			{ vec3f(hi.x + 10, 0, 0), vec3f(-1, 0, 0) },
+			{ vec3f(0, hi.y + 30, 0), vec3f(0, -1, 0) },
+		};
+		for (size_t i = 0; i < std::min(p.plans, std::size(walls)); i++)
+			plans.emplace_back(walls[i].first, walls[i].second, diffuse[i % std::size(diffuse)]);
+
+		// above the spheres and around the camera, sharing about the light of init_scene
+		lights.reserve(lights.size() + p.lights);
+		for (size_t i = 0; i < p.lights; i++)
+		{
+			vec3f const pos(gen.random_float() * 60 - 30, 15 + gen.random_float() * 25, gen.random_float() * 60 - 40);
+			lights.emplace_back(pos, 5.0f / std::max<size_t>(p.lights, 1));
+		}
+		scene_dirty = true;
+		return true;
+	}
+
+	// must be called after the scene lights or primitives change
+	void build_acceleration() noexcept
+	{
+		trace::scope const timed("acceleration build", "scene");
+		materials.build_lobes();
+
+		// the light structures and the primitive grid don't depend on each other
+		for (auto& l : lights)
+			l.radius = l.influence_radius(light_cutoff);
+		std::future<void> lights_built = std::async(std::launch::async, [this]
+		{
+			light_bvh.build(lights);
+			light_cells.build(lights);
+		});
+		for_each_shape_set([](auto& set) { set.build_packs(); });
+		primitive_cells.build(accel == acceleration::grid ? bounded_count() : 0, 2.0f, [&](size_t i, bounds& b)
+		{
+			return visit_bounded(i, [&](auto const& primitive)
+			{
+				b = primitive.bound();
+				return true;
+			});
+		});
+		lights_built.get();
+		scene_dirty = false;
+	}
+
+	// tiles of at most size x size pixels covering the image, row by row
+	[[nodiscard]] std::vector<tile> make_tiles(uint32_t size) const
+	{
+		std::vector<tile> tiles;
+		for (uint32_t y = 0; y < height; y += size)
+			for (uint32_t x = 0; x < width; x += size)
+				tiles.push_back({ x, y, std::min<uint32_t>(x + size, width), std::min<uint32_t>(y + size, height) });
+		return tiles;
+	}
+
+	// same tiles shrunk to the part of them the given regions cover, tiles they miss are left out
+	// a tile several regions overlap keeps the box around all of them so no pixel is rendered twice
+	[[nodiscard]] std::vector<tile> make_tiles(uint32_t size, tile const* regions, size_t count) const
+	{
+		std::vector<tile> tiles;
+		for (tile const& t : make_tiles(size))
+		{
+			tile covered = { t.x1, t.y1, t.x0, t.y0 };
+			for (size_t r = 0; r < count; r++)
+			{
+				tile const c = { std::max(t.x0, regions[r].x0), std::max(t.y0, regions[r].y0), std::min(t.x1, regions[r].x1), std::min(t.y1, regions[r].y1) };
+				if (c.x0 >= c.x1 || c.y0 >= c.y1)
+					continue;
+				covered = { std::min(covered.x0, c.x0), std::min(covered.y0, c.y0), std::max(covered.x1, c.x1), std::max(covered.y1, c.y1) };
+			}
+			if (covered.x0 < covered.x1)
+				tiles.push_back(covered);
+		}
+		return tiles;
+	}
+
+	void render() noexcept
+	{
+		std::vector<tile> const tiles = make_tiles(tile_size);
+		render_tiles(tiles.data(), tiles.size());
+	}
+
+	// renders only the pixels inside roi, the rest of the image is kept
+	void render_region(tile const& roi) noexcept
+	{
+		render_regions(&roi, 1);
+	}
+
+	void render_regions(tile const* regions, size_t count) noexcept
+	{
+		std::vector<tile> const tiles = make_tiles(tile_size, regions, count);
+		render_tiles(tiles.data(), tiles.size());
+	}
+
+	// screen rectangle of the camera rays that can hit primitive id, empty (x0 == x1) if it is behind the camera
+	// plans and primitives around the camera cover the whole image
+	[[nodiscard]] tile screen_bounds(size_t id) const noexcept
+	{
+		bounds b;
+		if (!visit_bounded(id, [&](auto const& primitive) { b = primitive.bound(); return true; }))
+			return whole_image();
+		return project_sphere(b.center() - camPos, b.radius);
+	}
+
+	// applies edit to primitive id, if it takes that kind of primitive, and marks the pixels it can change dirty
+	// e.g. edit_primitive(2, [](sphere& s) { s.geom.y += 1; })
+	template<typename F>
+	void edit_primitive(size_t id, F&& edit)
+	{
+		std::vector<tile> const before = affected_pixels(id);
+		bool const edited = visit_primitive(id, [&](auto& primitive)
+		{
+			if constexpr (std::is_invocable_v<F&, decltype(primitive)>)
+			{
+				edit(primitive);
+				return true;
+			}
+			else
+				return false;
+		});
+		if (!edited)
+			return;
+		scene_dirty = true;
+		for (tile const& t : before)
+			mark_dirty(t);
+		for (tile const& t : affected_pixels(id))
+			mark_dirty(t);
+	}
+
+	void mark_dirty(tile const& t)
+	{
+		if (t.x0 < t.x1 && t.y0 < t.y1)
+			dirty.push_back(t);
+	}
+
+	// re-renders the union of the dirty rectangles and forgets them, a camera move still needs a full render()
+	void render_dirty() noexcept
+	{
+		render_regions(dirty.data(), dirty.size());
+		dirty.clear();
+	}
+
+	// make_tiles() sorted by the distance of their center to the center of the image, where the viewer looks first
+	[[nodiscard]] std::vector<tile> make_tiles_center_first(uint32_t size) const
+	{
+		std::vector<tile> tiles = make_tiles(size);
+		auto const distance2 = [&](tile const& t)
+		{
+			int64_t const dx = int64_t(t.x0) + t.x1 - int64_t(width), dy = int64_t(t.y0) + t.y1 - int64_t(height);
+			return dx * dx + dy * dy;
+		};
+		std::stable_sort(tiles.begin(), tiles.end(), [&](tile const& a, tile const& b) { return distance2(a) < distance2(b); });
+		return tiles;
+	}
+
+	// coarse to fine preview: traces one pixel per coarsest x coarsest block, then halves the blocks down to single pixels
+	// each level only traces the pixels the coarser ones didn't and fills the others in bilinearly from the traced ones
+	// preview(step) is called once the image is complete at a level, the first time after about 1 / coarsest^2 of the
+	// frame time, the last time with step 1 and the same image render() makes, coarsest should be a power of two
+	template<typename F>
+	void render_progressive(F&& preview, uint32_t coarsest = 8)
+	{
+		std::vector<tile> const tiles = make_tiles_center_first(tile_size);
+		for (uint32_t step = coarsest, traced_step = 0; step >= 1; traced_step = step, step /= 2)
+		{
+			render_tiles(tiles.data(), tiles.size(), clock::time_point::max(), { step, traced_step });
+			if (step > 1)
+				fill_between(step);
+			preview(step);
+		}
+	}
+
+	// renders a complete frame within budget, trading resolution, samples per pixel and depth for time
+	// msaa and max_depth are the best quality asked for, the frame starts from a coarse pass that is always finished
+	// and is refined by the best pass the ray throughput measured so far says still fits, a full resolution refinement
+	// running late stops taking tiles so the ones left keep the coarser pass
+	frame_quality render_within(std::chrono::duration<double> budget) noexcept
+	{
+		auto const start = clock::now();
+		auto const deadline = start + std::chrono::duration_cast<clock::duration>(budget);
+		wait_loaded();
+		if (scene_dirty)
+			build_acceleration();
+
+		// from coarsest to the requested quality
+		std::vector<frame_quality> ladder;
+		auto const add_level = [&](float scale, unsigned spp, unsigned depth)
+		{
+			spp = std::min(spp, msaa);
+			depth = std::min(depth, max_depth);
+			if (ladder.empty() || ladder.back().resolution_scale != scale || ladder.back().spp != spp || ladder.back().max_depth != depth)
+				ladder.push_back({ static_cast<unsigned>(ladder.size()), scale, spp, depth });
+		};
+		add_level(0.0625f, 1, 0);
+		add_level(0.125f, 1, 0);
+		add_level(0.25f, 1, 1);
+		add_level(0.5f, 1, 1);
+		add_level(1.0f, 1, 1);
+		add_level(1.0f, 1, max_depth);
+		for (unsigned spp = 2; spp < msaa * 2; spp *= 2)
+			add_level(1.0f, spp, max_depth);
+
+		// deeper levels than measured are extrapolated with the growth seen between the two deepest measured ones,
+		// or guessed to double the cost at each bounce
+		std::vector<double>& rays_per_primary = costs.rays_per_primary;
+		rays_per_primary.resize(std::max<size_t>(rays_per_primary.size(), max_depth + 1), 0.0);
+		auto const predicted_seconds = [&](frame_quality const& q)
+		{
+			unsigned deepest = q.max_depth + 1, below = 0;
+			for (unsigned d = q.max_depth + 1; d-- > 0 && below == 0;)
+				if (rays_per_primary[d] > 0.0 && deepest > q.max_depth)
+					deepest = d;
+				else if (rays_per_primary[d] > 0.0 && d < deepest)
+					below = d + 1;
+			double cost = 1.0;
+			if (deepest <= q.max_depth)
+			{
+				double const growth = below == 0 ? 2.0
+					: std::clamp(std::pow(rays_per_primary[deepest] / rays_per_primary[below - 1], 1.0 / (deepest - below + 1)), 1.0, 2.0);
+				cost = rays_per_primary[deepest] * std::pow(growth, q.max_depth - deepest);
+			}
+			else
+				cost = std::pow(2.0, q.max_depth + 1);
+			double const pixels = static_cast<double>(scaled(width, q.resolution_scale)) * scaled(height, q.resolution_scale);
+			return pixels * q.spp * cost / costs.rays_per_second + (q.resolution_scale < 1.0f ? costs.upsample_seconds : 0.0);
+		};
+		// last moment a pass may start a tile so that a single thread still finishes it, and the upsampling after
+		// the pass, by the deadline
+		auto const tile_stop = [&](frame_quality const& q)
+		{
+			size_t const w = scaled(width, q.resolution_scale), h = scaled(height, q.resolution_scale);
+			double const tiles = static_cast<double>((w + tile_size - 1) / tile_size) * ((h + tile_size - 1) / tile_size);
+			double const threads = std::max(1u, std::thread::hardware_concurrency());
+			double const upsample = q.resolution_scale < 1.0f ? costs.upsample_seconds : 0.0;
+			double const tile_seconds = (predicted_seconds(q) - upsample) * threads / std::max(tiles, 1.0);
+			return deadline - std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(tile_seconds + upsample));
+		};
+		auto const seconds_left = [&] { return std::chrono::duration<double>(deadline - clock::now()).count(); };
+		// highest level above from that should be done with a safety margin in the time given
+		auto const best_fit = [&](size_t from, double seconds)
+		{
+			size_t best = from;
+			for (size_t l = from + 1; l < ladder.size(); l++)
+				if (costs.rays_per_second > 0.0 && predicted_seconds(ladder[l]) < 0.8 * seconds)
+					best = l;
+			return best;
+		};
+
+		unsigned const user_msaa = msaa, user_depth = max_depth;
+		bool const user_aux = aux_buffers;
+		frame_quality reached;
+		uint64_t frame_rays = 0;
+		// the coarsest pass has to finish whatever it costs, it is what's left if the measured throughput was wrong
+		size_t level = 0;
+		for (bool first = true; ; first = false)
+		{
+			frame_quality q = ladder[level];
+			msaa = q.spp;
+			max_depth = q.max_depth;
+			uint64_t const rays_before = stats.rays + stats.shadow_rays;
+			double trace_seconds = 0.0;
+			if (q.resolution_scale < 1.0f)
+			{
+				// scaled passes are all or nothing, the image only changes once one is done
+				aux_buffers = false;
+				q.coverage = render_scaled(q.resolution_scale, first ? clock::time_point::max() : tile_stop(q), trace_seconds) ? 1.0f : 0.0f;
+			}
+			else
+			{
+				aux_buffers = user_aux;
+				std::vector<tile> const tiles = make_tiles(tile_size);
+				clock::time_point const stop = first ? clock::time_point::max() : tile_stop(q);
+				auto const trace_start = clock::now();
+				q.coverage = static_cast<float>(render_tiles(tiles.data(), tiles.size(), stop)) / static_cast<float>(image.size());
+				trace_seconds = std::chrono::duration<double>(clock::now() - trace_start).count();
+			}
+			uint64_t const pass_rays = stats.rays + stats.shadow_rays - rays_before;
+			frame_rays += pass_rays;
+			if (pass_rays > 0 && trace_seconds > 0.0)
+			{
+				// recent passes count the most, the scene or the machine load may have changed since the last frame
+				double const rate = pass_rays / trace_seconds;
+				costs.rays_per_second = costs.rays_per_second > 0.0 ? 0.5 * (costs.rays_per_second + rate) : rate;
+				double const primaries = static_cast<double>(scaled(width, q.resolution_scale)) * scaled(height, q.resolution_scale) * q.spp * q.coverage;
+				if (primaries > 0.0)
+					rays_per_primary[q.max_depth] = pass_rays / primaries;
+			}
+			if (q.coverage > 0.0f)
+				reached = q;
+			if (q.coverage < 1.0f)
+				break;
+			size_t const next = best_fit(level, seconds_left());
+			if (next == level)
+				break;
+			level = next;
+		}
+
+		msaa = user_msaa;
+		max_depth = user_depth;
+		aux_buffers = user_aux;
+		// the auxiliary buffers only hold something matching the image if it was traced at full resolution
+		if (reached.resolution_scale < 1.0f)
+		{
+			normals.clear();
+			depths.clear();
+			albedos.clear();
+		}
+		reached.seconds = std::chrono::duration<double>(clock::now() - start).count();
+		reached.rays_per_second = reached.seconds > 0.0 ? frame_rays / reached.seconds : 0.0;
+		return reached;
+	}
+
+	// renders the pixels of grid in the given tiles in parallel, the rest of the image is left untouched
+	// tiles not started by stop are skipped, returns how many pixels were rendered
+	size_t render_tiles(tile const* tiles, size_t count, clock::time_point stop = clock::time_point::max(), pixel_grid grid = {}) noexcept
+	{
+		wait_loaded();
+		if (scene_dirty)
+			build_acceleration();
+		if (aux_buffers && normals.size() != image.size())
+		{
+			normals.assign(image.size(), vec3f(0, 0, 0));
+			depths.assign(image.size(), std::numeric_limits<float>::infinity());
+			albedos.assign(image.size(), Color::none);
+		}
+
+		trace::scope const timed("render tiles", "render");
+		size_t rendered = 0;
+		#pragma omp parallel
+		{
+			tls.last_occluder.assign(lights.size(), -1);
+			tls.stats = {};
+			size_t pixels = 0;
+
+			#pragma omp for schedule(dynamic, 1)
+			for (int t = 0; t < static_cast<int>(count); t++)
+			{
+				if (stop != clock::time_point::max() && clock::now() >= stop)
+					continue;
+				trace::scope const timed("tile", "render", static_cast<int32_t>(tiles[t].x0), static_cast<int32_t>(tiles[t].y0));
+				pixels += render_tile(tiles[t], grid);
+			}
+
+			#pragma omp critical
+			{
+				stats += tls.stats;
+				rendered += pixels;
+			}
+		}
+		return rendered;
+	}
+
+	// copies the pixels of t out of / into the image, row by row
+	void read_tile(tile const& t, color* out) const noexcept
+	{
+		for (uint32_t y = t.y0; y < t.y1; y++)
+			out = std::copy(&image[y * width + t.x0], &image[y * width + t.x1], out);
+	}
+
+	void write_tile(tile const& t, color const* in) noexcept
+	{
+		for (uint32_t y = t.y0; y < t.y1; y++, in += t.x1 - t.x0)
+			std::copy(in, in + (t.x1 - t.x0), &image[y * width + t.x0]);
+	}
+
+	[[nodiscard]] size_t image_width() const noexcept { return width; }
+	[[nodiscard]] size_t image_height() const noexcept { return height; }
+	[[nodiscard]] float field_of_view() const noexcept { return fov; }
+	[[nodiscard]] vec3f camera_position() const noexcept { return camPos; }
+	[[nodiscard]] vec3f camera_direction() const noexcept { return camDir; }
+
+	void resize(size_t iwidth, size_t iheight)
+	{
+		width = iwidth;
+		height = iheight;
+		image.assign(width * height, Color::none);
+		normals.clear();
+		depths.clear();
+		albedos.clear();
+	}
+
+	void set_fov(float ifov) noexcept { fov = ifov; }
+
+	// the grid is only built for acceleration::grid, so a change rebuilds it before the next render
+	void set_acceleration(acceleration a) noexcept
+	{
+		scene_dirty = scene_dirty || a != accel;
+		accel = a;
+	}
+
+	[[nodiscard]] acceleration get_acceleration() const noexcept { return accel; }
+
+	// dir doesn't need to be normalized, the camera is kept upright
+	void set_camera(vec3f const& pos, vec3f const& dir) noexcept
+	{
+		camPos = pos;
+		camDir = vec3f(dir).normalize();
+	}
+
+	// plain text scene description, one element per line:
+	//	material r g b a ka kd ks kr reflect refraction_index specular_exponent
+	//	sphere x y z radius material
+	//	box x y z half_x half_y half_z ux uy uz vx vy vz material	half sizes along u, v and u x v
+	//	disc x y z nx ny nz radius material
+	//	rectangle x y z ax ay az bx by bz material	a and b are half edges
+	//	cylinder x y z ax ay az radius half_height material
+	//	plane x y z nx ny nz material
+	//	light x y z intensity
+	// materials are referenced by their order of appearance
+	void save_scene(std::ostream& out) const
+	{
+		auto const precision = out.precision(std::numeric_limits<float>::max_digits10);
+		for (size_t i = 0; i < materials.size(); i++)
+		{
+			material const m = materials.get(i);
+			out << "material " << m.col << m.ka << ' ' << m.kd << ' ' << m.ks << ' ' << m.kr << ' '
+				<< m.reflect << ' ' << m.refraction_index << ' ' << m.specular_exponent << '\n';
+		}
+		for (auto const& s : spheres)
+			out << "sphere " << s.center() << s.radius() << ' ' << s.mtrl << '\n';
+		for (auto const& b : boxes.items)
+			out << "box " << b.center << b.half << b.u << b.v << b.mtrl << '\n';
+		for (auto const& d : discs.items)
+			out << "disc " << d.center << d.normal << d.radius << ' ' << d.mtrl << '\n';
+		for (auto const& r : rectangles.items)
+			out << "rectangle " << r.center << r.a << r.b << r.mtrl << '\n';
+		for (auto const& c : cylinders.items)
+			out << "cylinder " << c.center << c.axis << c.radius << ' ' << c.half_height << ' ' << c.mtrl << '\n';
+		for (auto const& p : plans)
+			out << "plane " << p.pos << p.normal << p.mtrl << '\n';
+		for (auto const& l : lights)
+			out << "light " << l.pos << l.intensity << '\n';
+		out.precision(precision);
+	}
+
+	// appends the elements of a save_scene() description, false on a malformed line
+	bool load_scene(std::istream& in)
+	{
+		trace::scope const timed("scene parse", "io");
+		std::vector<uint16_t> remap;
+		// reads the index of a material defined earlier in the file, failing the line on any other
+		auto const read_material = [&](std::istream& ls) -> uint16_t
+		{
+			size_t i;
+			if (ls >> i && i >= remap.size())
+				ls.setstate(std::ios::failbit);
+			return ls ? remap[i] : 0;
+		};
+		std::string line;
+		while (std::getline(in, line))
+		{
+			std::istringstream ls(line);
+			std::string kind;
+			if (!(ls >> kind) || kind[0] == '#')
+				continue;
+			if (kind == "material")
+			{
+				material m;
+				ls >> m.col.x >> m.col.y >> m.col.z >> m.col.w >> m.ka >> m.kd >> m.ks >> m.kr >> m.reflect >> m.refraction_index >> m.specular_exponent;
+				uint16_t id[1];
+				if (ls && !add_materials({ m }, id))
+					return false;
+				if (ls)
+					remap.push_back(id[0]);
+			}
+			else if (kind == "sphere")
+			{
+				vec3f p;
+				float r;
+				ls >> p.x >> p.y >> p.z >> r;
+				uint16_t const m = read_material(ls);
+				if (ls)
+					spheres.emplace_back(p, r, m);
+			}
+			else if (kind == "box")
+			{
+				vec3f p, half, u, v;
+				ls >> p.x >> p.y >> p.z >> half.x >> half.y >> half.z >> u.x >> u.y >> u.z >> v.x >> v.y >> v.z;
+				uint16_t const m = read_material(ls);
+				if (ls)
+					boxes.items.emplace_back(p, half, u, v, m);
+			}
+			else if (kind == "disc")
+			{
+				vec3f p, n;
+				float r;
+				ls >> p.x >> p.y >> p.z >> n.x >> n.y >> n.z >> r;
+				uint16_t const m = read_material(ls);
+				if (ls)
+					discs.items.emplace_back(p, n, r, m);
+			}
+			else if (kind == "rectangle")
+			{
+				vec3f p, a, b;
+				ls >> p.x >> p.y >> p.z >> a.x >> a.y >> a.z >> b.x >> b.y >> b.z;
+				uint16_t const m = read_material(ls);
+				if (ls)
+					rectangles.items.emplace_back(p, a, b, m);
+			}
+			else if (kind == "cylinder")
+			{
+				vec3f p, axis;
+				float r, half_height;
+				ls >> p.x >> p.y >> p.z >> axis.x >> axis.y >> axis.z >> r >> half_height;
+				uint16_t const m = read_material(ls);
+				if (ls)
+					cylinders.items.emplace_back(p, axis, r, half_height, m);
+			}
+			else if (kind == "plane")
+			{
+				vec3f p, n;
+				ls >> p.x >> p.y >> p.z >> n.x >> n.y >> n.z;
+				uint16_t const m = read_material(ls);
+				if (ls)
+					plans.emplace_back(p, n, m);
+			}
+			else if (kind == "light")
+			{
+				vec3f p;
+				float intensity;
+				ls >> p.x >> p.y >> p.z >> intensity;
+				if (ls)
+					lights.emplace_back(p, intensity);
+			}
+			else
+			{
+				std::cerr << "unknown scene element : " << kind << "\n";
+				return false;
+			}
+			if (!ls)
+			{
+				std::cerr << "malformed scene line : " << line << "\n";
+				return false;
+			}
+		}
+		scene_dirty = true;
+		return true;
+	}
+
+	// spread is the angle covered by the ray, it blurs the lookup to the matching mip level
+	color get_env_map_color(vec3f dir, float spread = 0.0f) const noexcept
+	{
+		if (env_map.size() == 0)
+			return clear_color;
+		float const phi = atan2(dir.z, dir.x);
+		float const theta = acos(std::clamp(dir.y, -1.0f, 1.0f));
+		// a texel spans less angle horizontally towards the poles, the isotropic lookup takes the wider extent
+		float const footprint = spread * env_map.width / (2 * M_PI) / std::max(std::sin(theta), 0.05f);
+		vec3f const col = env_map.sample((phi / M_PI + 1) / 2, theta / M_PI, footprint);
+		return color{ col.x, col.y, col.z, 1.0f };
+	}
+
+	// edge avoiding a-trous wavelet filter (Dammertz et al. 2010) over the image, guided by the auxiliary buffers
+	// each pass widens the 5x5 B3 spline kernel by skipping 2^pass - 1 pixels between taps, so a few passes cover a large
+	// footprint at 25 taps per pixel, neighbours whose normal, depth, albedo or color differ get no weight
+	// needs aux_buffers to have been set for the last render(), does nothing otherwise
+	void denoise(unsigned passes = 5) noexcept
+	{
+		if (normals.size() != image.size())
+			return;
+		trace::scope const timed("denoise", "post");
+		float constexpr kernel[5] = { 1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4, 1.0f / 16 };
+		float constexpr depth_sigma = 0.02f;	// relative depth difference per pixel of step
+		float constexpr albedo_sigma2 = 0.1f * 0.1f;
+		float color_sigma2 = 16.0f;				// halved every pass, as the noise left decreases
+		int const w = static_cast<int>(width);
+		int const h = static_cast<int>(height);
+
+		std::vector<color> filtered(image.size());
+		for (unsigned pass = 0; pass < passes; pass++, color_sigma2 *= 0.5f)
+		{
+			int const step = 1 << pass;
+			#pragma omp parallel for schedule(static)
+			for (int y = 0; y < h; y++)
+			{
+				for (int x = 0; x < w; x++)
+				{
+					size_t const p = static_cast<size_t>(x + y * w);
+					color const c = image[p];
+					vec3f const n = normals[p];
+					float const z = depths[p];
+					color const a = albedos[p];
+					color sum = Color::none;
+					float weight_sum = 0.0f;
+					for (int dy = -2; dy <= 2; dy++)
+					{
+						int const qy = std::clamp(y + dy * step, 0, h - 1);
+						for (int dx = -2; dx <= 2; dx++)
+						{
+							int const qx = std::clamp(x + dx * step, 0, w - 1);
+							size_t const q = static_cast<size_t>(qx + qy * w);
+							vec3f const nq = normals[q];
+							float normal_weight = 1.0f;
+							if (n.norm2() > 0.0f || nq.norm2() > 0.0f)
+							{
+								normal_weight = std::max(0.0f, dot(n, nq));
+								for (int k = 0; k < 6; k++)	// ^64
+									normal_weight *= normal_weight;
+							}
+							color const da = albedos[q] - a;
+							color const dc = image[q] - c;
+							float const distance = depth_difference(z, depths[q]) / (depth_sigma * step)
+								+ (da.x * da.x + da.y * da.y + da.z * da.z) / albedo_sigma2
+								+ (dc.x * dc.x + dc.y * dc.y + dc.z * dc.z) / color_sigma2;
+							float const weight = kernel[dx + 2] * kernel[dy + 2] * normal_weight * std::exp(-distance);
+							sum = sum + image[q] * weight;
+							weight_sum += weight;
+						}
+					}
+					// the center tap always has full weight so weight_sum can't be 0
+					filtered[p] = sum * (1.0f / weight_sum);
+				}
+			}
+			image.swap(filtered);
+		}
+	}
+
+	void game_boy_pass() noexcept
+	{
+		trace::scope const timed("game boy", "post");
 		float const l1 = 0.9;
 		float const l2 = 0.7;
 		float const l3 = 0.5;
 		
 		for(auto& c : image)
 		{
-			float const n = c.norm();
-			if (n > l1)
+			float const n = c.norm();
+			if (n > l1)
+			{
+				c.x = 0.607;
+				c.y = 0.737;
+				c.z = 0.058;
+			}
+			else if (n > l2)
+			{
+				c.x = 0.545;
+				c.y = 0.674;
+				c.z = 0.058;
+
+			}
+			else if (n > l3)
+			{
+				c.x = 0.188;
+				c.y = 0.384;
+				c.z = 0.188;
+			}
+			else
+			{
+				c.x = 0.058;
+				c.y = 0.219;
+				c.z = 0.058;
+			}
+		}
+	}
+	
+	struct color8bit {
+		uint8_t r, g, b, a;
+	};
+
+	[[nodiscard]] std::vector<color8bit> to_8bit() const
+	{
+		std::vector<color8bit> buffer(image.size());
+		for (size_t i = 0; i < buffer.size(); i++)
+		{
+			buffer[i].r = std::min<int>(image[i].x * 255, 255);
+			buffer[i].g = std::min<int>(image[i].y * 255, 255);
+			buffer[i].b = std::min<int>(image[i].z * 255, 255);
+			buffer[i].a = std::min<int>(image[i].w * 255, 255);
+		}
+		return buffer;
+	}
+
+	void save(const char* fileName = "out.jpg") const noexcept
+	{
+		trace::scope const timed("encode jpeg", "encode");
+		std::vector<color8bit> const buffer = to_8bit();
+		stbi_write_jpg(fileName, width, height, 4, buffer.data(), 100);
+	}
+
+	// encodes the image as jpeg, handing the bytes to write(context, data, size) as they are produced
+	void save(stbi_write_func* write, void* context) const noexcept
+	{
+		trace::scope const timed("encode jpeg", "encode");
+		std::vector<color8bit> const buffer = to_8bit();
+		stbi_write_jpg_to_func(write, context, width, height, 4, buffer.data(), 100);
+	}
+
+	color clear_color = Color::black;
+	unsigned max_depth = 1;
+	unsigned msaa = 1;
+	// samples land at random positions inside the pixel instead of along its diagonal
+	bool jitter = false;
+	// render() also writes the normal, depth and albedo of the first hits, which denoise() needs
+	bool aux_buffers = false;
+	// seeds every random number, together with the pixel and sample, so a frame renders the same every time
+	uint32_t frame = 0;
+	uint32_t tile_size = 32;
+	pixel_order order = pixel_order::row_major;
+	light_sampling light_mode = light_sampling::exhaustive;
+	unsigned light_samples = 1;
+	// lights fall off with distance and stop at the radius where they drop below this value, 0 disables falloff
+	// changing it requires build_acceleration()
+	float light_cutoff = 0.0f;
+	render_stats stats;
+	
+	private:
+
+	// scratch state of the calling rendering thread
+	static inline thread_local thread_state tls;
+
+	// distance skipped at the start of rays leaving a surface so they don't hit it again
+	static constexpr float ray_epsilon = 1e-3f;
+
+	[[nodiscard]] tile whole_image() const noexcept
+	{
+		return { 0, 0, static_cast<uint32_t>(width), static_cast<uint32_t>(height) };
+	}
+
+	// ids[i] receives the index of list[i], false once the material table is full
+	template<size_t N>
+	bool add_materials(material const (&list)[N], uint16_t (&ids)[N]) noexcept
+	{
+		for (size_t i = 0; i < N; i++)
+		{
+			std::optional<uint16_t> const id = materials.add(list[i]);
+			if (!id)
+			{
+				std::cerr << "too many materials, at most " << std::numeric_limits<uint16_t>::max() + 1 << "\n";
+				return false;
+			}
+			ids[i] = *id;
+		}
+		return true;
+	}
+
+	// screen rectangle of the camera rays that can hit a sphere at rel from the camera, as render_tile maps them
+	// only the direction of rel and the ratio of radius to its length matter, so a sphere "at infinity" works too
+	[[nodiscard]] tile project_sphere(vec3f const& rel, float radius) const noexcept
+	{
+		vec3f right, up;
+		camera_basis(right, up);
+		float const z = dot(rel, camDir);
+		if (z + radius <= 0.0f)
+			return { 0, 0, 0, 0 };
+
+		// slopes (a / z) of the rays touching the sphere, in the plane of one screen axis and the view direction
+		float const inf = std::numeric_limits<float>::infinity();
+		float lo[2], hi[2];
+		float const a[2] = { dot(rel, right), dot(rel, up) };
+		for (int k = 0; k < 2; k++)
+		{
+			float const d = std::sqrt(a[k] * a[k] + z * z);
+			if (d <= radius)
+				return whole_image();
+			float const center = std::atan2(a[k], z), half = std::asin(radius / d);
+			lo[k] = center - half <= -M_PI / 2 ? -inf : std::tan(center - half);
+			hi[k] = center + half >= M_PI / 2 ? inf : std::tan(center + half);
+		}
+
+		// with room for msaa samples reaching into the next pixels
+		float const tf2 = tanf(fov / 2.0f);
+		float const aspect = width / static_cast<float>(height);
+		auto const pixel = [](float v, size_t size) { return std::clamp(v, 0.0f, static_cast<float>(size)); };
+		float const x0 = pixel((lo[0] / (tf2 * aspect) + 1) * width / 2 - 2, width);
+		float const x1 = pixel((hi[0] / (tf2 * aspect) + 1) * width / 2 + 2, width);
+		float const y0 = pixel((1 - hi[1] / tf2) * height / 2 - 2, height);
+		float const y1 = pixel((1 - lo[1] / tf2) * height / 2 + 2, height);
+		return { static_cast<uint32_t>(x0), static_cast<uint32_t>(y0), static_cast<uint32_t>(std::ceil(x1)), static_cast<uint32_t>(std::ceil(y1)) };
+	}
+
+	// rectangles holding every pixel primitive id can change: where it is seen, the primitives its shadows can fall on
+	// and every mirror or glass surface, since it may be seen through them
+	[[nodiscard]] std::vector<tile> affected_pixels(size_t id) const
+	{
+		bounds b;
+		if (!visit_bounded(id, [&](auto const& primitive) { b = primitive.bound(); return true; }))
+			return { whole_image() };
+		std::vector<tile> rects = { project_sphere(b.center() - camPos, b.radius) };
+		size_t const bounded = bounded_count();
+		for (light const& l : lights)
+		{
+			// the shadow is inside the cone from the light around the bounding sphere, past the sphere
+			vec3f const away = b.center() - l.pos;
+			float const distance = away.norm();
+			if (distance <= b.radius)
+				return { whole_image() };
+			float const half_angle = std::asin(b.radius / distance);
+			vec3f const dir = away * (1.0f / distance);
+			// plans go on forever, the cone itself is projected: it lies in the hull of the sphere and of its image
+			// at infinity, as long as it doesn't pass behind the camera
+			if (!plans.empty())
+			{
+				if (dot(dir, camDir) <= b.radius / distance)
+					return { whole_image() };
+				rects.push_back(project_sphere(dir, b.radius / distance));
+			}
+			for (size_t other = 0; other < bounded; other++)
+			{
+				bounds r;
+				visit_bounded(other, [&](auto const& primitive) { r = primitive.bound(); return true; });
+				vec3f const to = r.center() - l.pos;
+				float const d = to.norm();
+				if (other == id || d + r.radius <= distance - b.radius)
+					continue;
+				float const angle = std::acos(std::clamp(dot(to, dir) / std::max(d, 1e-6f), -1.0f, 1.0f));
+				if (d <= r.radius || angle <= half_angle + std::asin(r.radius / d))
+					rects.push_back(project_sphere(r.center() - camPos, r.radius));
+			}
+		}
+		if (max_depth > 0)
+		{
+			for (size_t other = 0; other < bounded + plans.size(); other++)
+			{
+				visit_primitive(other, [&](auto const& primitive)
+				{
+					if (materials.reflect[primitive.mtrl] > 0.0f || materials.refraction_index[primitive.mtrl] > 0.0f)
+						rects.push_back(screen_bounds(other));
+					return true;
+				});
+			}
+		}
+		return rects;
+	}
+
+	// fills the pixels off the grid of step pixels in bilinearly from the ones on it
+	void fill_between(uint32_t step) noexcept
+	{
+		trace::scope const timed("fill", "post");
+		size_t const last_x = (width - 1) / step * step, last_y = (height - 1) / step * step;
+		#pragma omp parallel for schedule(static)
+		for (int y = 0; y < static_cast<int>(height); y++)
+		{
+			size_t const y0 = y / step * step, y1 = std::min<size_t>(y0 + step, last_y);
+			float const ty = static_cast<float>(y - y0) / step;
+			for (size_t x = 0; x < width; x++)
+			{
+				if (x % step == 0 && y0 == static_cast<size_t>(y))
+					continue;
+				size_t const x0 = x / step * step, x1 = std::min<size_t>(x0 + step, last_x);
+				float const tx = static_cast<float>(x - x0) / step;
+				color const top = image[x0 + y0 * width] * (1 - tx) + image[x1 + y0 * width] * tx;
+				color const bottom = image[x0 + y1 * width] * (1 - tx) + image[x1 + y1 * width] * tx;
+				image[x + y * width] = top * (1 - ty) + bottom * ty;
+			}
+		}
+	}
+
+	[[nodiscard]] static size_t scaled(size_t size, float scale) noexcept
+	{
+		return std::max<size_t>(1, static_cast<size_t>(size * scale + 0.5f));
+	}
+
+	// renders the whole frame at a fraction of the resolution and upsamples it bilinearly over the image
+	// false, with the image untouched, if some tile couldn't be started by stop
+	bool render_scaled(float scale, clock::time_point stop, double& trace_seconds) noexcept
+	{
+		auto const start = clock::now();
+		size_t const full_width = width, full_height = height;
+		std::vector<color> full = std::move(image);
+		width = scaled(full_width, scale);
+		height = scaled(full_height, scale);
+		image.assign(width * height, Color::none);
+		std::vector<tile> const tiles = make_tiles(tile_size);
+		bool const done = render_tiles(tiles.data(), tiles.size(), stop) == image.size();
+		auto const traced = clock::now();
+		trace_seconds = std::chrono::duration<double>(traced - start).count();
+		std::vector<color> const low = std::move(image);
+		size_t const low_width = width, low_height = height;
+		image = std::move(full);
+		width = full_width;
+		height = full_height;
+		if (!done)
+			return false;
+
+		trace::scope const timed("upsample", "post");
+		float const sx = static_cast<float>(low_width) / width, sy = static_cast<float>(low_height) / height;
+		#pragma omp parallel for schedule(static)
+		for (int y = 0; y < static_cast<int>(height); y++)
+		{
+			float const fy = std::clamp((y + 0.5f) * sy - 0.5f, 0.0f, static_cast<float>(low_height - 1));
+			size_t const y0 = static_cast<size_t>(fy), y1 = std::min(y0 + 1, low_height - 1);
+			float const ty = fy - y0;
+			for (size_t x = 0; x < width; x++)
+			{
+				float const fx = std::clamp((x + 0.5f) * sx - 0.5f, 0.0f, static_cast<float>(low_width - 1));
+				size_t const x0 = static_cast<size_t>(fx), x1 = std::min(x0 + 1, low_width - 1);
+				float const tx = fx - x0;
+				color const top = low[x0 + y0 * low_width] * (1 - tx) + low[x1 + y0 * low_width] * tx;
+				color const bottom = low[x0 + y1 * low_width] * (1 - tx) + low[x1 + y1 * low_width] * tx;
+				image[x + y * width] = top * (1 - ty) + bottom * ty;
+			}
+		}
+		costs.upsample_seconds = std::chrono::duration<double>(clock::now() - traced).count();
+		return true;
+	}
+
+	// relative difference of two depths in [0, 1], escaped rays only match each other
+	[[nodiscard]] static float depth_difference(float a, float b) noexcept
+	{
+		if (a == b)
+			return 0.0f;
+		if (std::isinf(a) || std::isinf(b))
+			return 1.0f;
+		return std::abs(a - b) / std::max(a, b);
+	}
+
+	// falls back to another up vector when looking straight up or down
+	void camera_basis(vec3f& right, vec3f& up) const noexcept
+	{
+		right = cross(camDir, vec3f(0, 1, 0));
+		if (right.norm2() < 1e-12f)
+			right = cross(camDir, vec3f(0, 0, 1));
+		right.normalize();
+		up = cross(right, camDir);
+	}
+
+	// returns how many pixels were traced
+	size_t render_tile(tile const& t, pixel_grid grid) noexcept
+	{
+		float const tf2 = tanf(fov / 2.0f);
+		vec3f const forward = camDir;
+		vec3f right, up;
+		camera_basis(right, up);
+		float const pixel_spread = 2 * tf2 / height;
+		auto const render_pixel = [&](size_t j, size_t i)
+		{
+			color sum = Color::none;
+			surface_sample surface_sum = { vec3f(0, 0, 0), 0.0f, Color::none };
+			for (unsigned m = 0; m < msaa; m++)
+			{
+				tls.rng = sampler(frame, static_cast<uint32_t>(j + i * width), m);
+				float sample_x = msaa > 1 ? static_cast<float>(m) / (msaa / 2) : 0.5f;
+				float sample_y = sample_x;
+				if (jitter)
+				{
+					sample_x = tls.rng.random_float();
+					sample_y = tls.rng.random_float();
+				}
+				float const x = (2 * (j + sample_x) / static_cast<float>(width) - 1) * tf2 * width / static_cast<float>(height);
+				float const y = -(2 * (i + sample_y) / static_cast<float>(height) - 1) * tf2;
+				vec3f const dir = (right * x + up * y + forward).normalize();
+				surface_sample surface;
+				sum = sum + cast_ray(camPos, dir, 0, aux_buffers ? &surface : nullptr, 0.0f, { 0.0f, pixel_spread });
+				if (aux_buffers)
+				{
+					surface_sum.normal = surface_sum.normal + surface.normal;
+					surface_sum.depth += surface.depth;
+					surface_sum.albedo = surface_sum.albedo + surface.albedo;
+				}
+			}
+			float const inv_msaa = 1.0f / static_cast<float>(msaa);
+			image[j + i * width] = sum * inv_msaa;
+			if (aux_buffers)
+			{
+				normals[j + i * width] = surface_sum.normal.norm2() > 0.0f ? surface_sum.normal.normalize() : surface_sum.normal;
+				depths[j + i * width] = surface_sum.depth * inv_msaa;
+				albedos[j + i * width] = surface_sum.albedo * inv_msaa;
+			}
+		};
+
+		size_t traced = 0;
+		if (order == pixel_order::row_major)
+		{
+			uint32_t const step = grid.step;
+			for (size_t i = (t.y0 + step - 1) / step * step; i < t.y1; i += step)
+				for (size_t j = (t.x0 + step - 1) / step * step; j < t.x1; j += step)
+					if (grid.contains(j, i))
+					{
+						render_pixel(j, i);
+						traced++;
+					}
+			return traced;
+		}
+		// the curve covers the smallest power of two square around the tile, points outside it are skipped
+		uint32_t const w = t.x1 - t.x0, h = t.y1 - t.y0;
+		uint32_t side = 1;
+		while (side < std::max(w, h))
+			side *= 2;
+		for (uint32_t d = 0; d < side * side; d++)
+		{
+			uint32_t x, y;
+			if (order == pixel_order::morton)
+				morton_decode(d, x, y);
+			else
+				hilbert_decode(side, d, x, y);
+			if (x < w && y < h && grid.contains(t.x0 + x, t.y0 + y))
+			{
+				render_pixel(t.x0 + x, t.y0 + y);
+				traced++;
+			}
+		}
+		return traced;
+	}
+
+	// accumulates the unshadowed contribution of one light, scaled by weight
+	void shade_light(size_t light_id, hitInfo const& hit, vec3f const& dir, float weight, float& diffuse, float& specular) noexcept
+	{
+		light const& light_it = lights[light_id];
+		vec3f light_dir = light_it.pos - hit.pos;
+		float const dist2 = light_dir.norm2();
+		float const intensity = light_it.intensity * light_it.attenuation(dist2);
+		if (intensity <= 0.0f)
+			return;
+		light_dir.normalize();
+		
+		// shadows
+		if (scene_occluded(hit.pos, light_dir, ray_epsilon, std::sqrt(dist2), light_id))
+			return;
+		
+		vec3f const R = reflect(-light_dir, hit.normal).normalize();
+
+		diffuse += weight * intensity * std::max(0.0f, dot(light_dir, hit.normal));
+		specular += weight * intensity * materials.specular(hit.mtrl, dot(R, -dir));
+	}
+
+	// spheres, boxes, discs, rectangles and cylinders, everything that can go in primitive_cells
+	[[nodiscard]] size_t bounded_count() const noexcept
+	{
+		return spheres.size() + boxes.items.size() + discs.items.size() + rectangles.items.size() + cylinders.items.size();
+	}
+
+	// the shape sets in primitive id order
+	template<typename F>
+	void for_each_shape_set(F&& f) const
+	{
+		f(boxes);
+		f(discs);
+		f(rectangles);
+		f(cylinders);
+	}
+
+	template<typename F>
+	void for_each_shape_set(F&& f)
+	{
+		f(boxes);
+		f(discs);
+		f(rectangles);
+		f(cylinders);
+	}
+
+	// returns f(primitive) for the primitive with the given id, or false if there is none
+	// ids run through spheres, boxes, discs, rectangles, cylinders then plans
+	template<typename F>
+	bool visit_primitive(size_t id, F&& f) const
+	{
+		// spheres first, they are most of the primitives and this is on every intersection test through the grid
+		if (id < spheres.size())
+			return f(spheres[id]);
+		size_t const bounded = bounded_count();
+		if (id < bounded)
+			return visit_bounded(id, f);
+		return id - bounded < plans.size() && f(plans[id - bounded]);
+	}
+
+	template<typename F>
+	bool visit_primitive(size_t id, F&& f)
+	{
+		size_t const bounded = bounded_count();
+		if (id < bounded)
+			return visit_bounded(id, f);
+		return id - bounded < plans.size() && f(plans[id - bounded]);
+	}
+
+	// same for the ids below bounded_count()
+	template<typename F>
+	bool visit_bounded(size_t id, F&& f) const
+	{
+		if (id < spheres.size())
+			return f(spheres[id]);
+		id -= spheres.size();
+		if (id < boxes.items.size())
+			return f(boxes.items[id]);
+		id -= boxes.items.size();
+		if (id < discs.items.size())
+			return f(discs.items[id]);
+		id -= discs.items.size();
+		if (id < rectangles.items.size())
+			return f(rectangles.items[id]);
+		id -= rectangles.items.size();
+		return id < cylinders.items.size() && f(cylinders.items[id]);
+	}
+
+	template<typename F>
+	bool visit_bounded(size_t id, F&& f)
+	{
+		if (id < spheres.size())
+			return f(spheres[id]);
+		id -= spheres.size();
+		if (id < boxes.items.size())
+			return f(boxes.items[id]);
+		id -= boxes.items.size();
+		if (id < discs.items.size())
+			return f(discs.items[id]);
+		id -= discs.items.size();
+		if (id < rectangles.items.size())
+			return f(rectangles.items[id]);
+		id -= rectangles.items.size();
+		return id < cylinders.items.size() && f(cylinders.items[id]);
+	}
+
+	[[nodiscard]] bool primitive_intersects(size_t id, vec3f const& origin, vec3f const& dir, float t_min, float& t_max) const noexcept
+	{
+		return visit_primitive(id, [&](auto const& primitive) { return primitive.ray_intersect(origin, dir, t_min, t_max); });
+	}
+
+	[[nodiscard]] bool primitive_occludes(int id, vec3f const& origin, vec3f const& dir, float t_min, float t_max) const noexcept
+	{
+		return primitive_intersects(static_cast<size_t>(id), origin, dir, t_min, t_max);
+	}
+
+	// everything below until image lives in scene_memory, so it has to be declared first
+	scene_arena scene_memory;
+
+	texture env_map{ &scene_memory };
+	
+	std::pmr::vector<plan> plans{ &scene_memory };
+	std::pmr::vector<sphere> spheres{ &scene_memory };
+	shape_set<box> boxes{ &scene_memory };
+	shape_set<disc> discs{ &scene_memory };
+	shape_set<rectangle> rectangles{ &scene_memory };
+	shape_set<cylinder> cylinders{ &scene_memory };
+	
+	material_table materials{ &scene_memory };
+	std::pmr::vector<light> lights{ &scene_memory };
+	light_tree light_bvh{ &scene_memory };
+	light_grid light_cells{ &scene_memory };
+	uniform_grid primitive_cells{ &scene_memory };	// every bounded primitive, plans stay out
+	acceleration accel = acceleration::none;
+	bool scene_dirty = true;
+	std::vector<tile> dirty;	// image rectangles render_dirty() has to redo
+	// what render_within() measured so far, plans the passes of the next frames
+	struct
+	{
+		double rays_per_second = 0.0;
+		double upsample_seconds = 0.0;
+		std::vector<double> rays_per_primary;	// rays a primary ray ends up costing, by max_depth
+	} costs;
+
+	std::vector<color> image;
+	// auxiliary buffers, only sized while aux_buffers is set
+	std::vector<vec3f> normals;
+	std::vector<float> depths;
+	std::vector<color> albedos;
+	size_t width, height;
+	float fov;
+	vec3f camPos = vec3f(0, 0, 0);
+	vec3f camDir = vec3f(0, 0, -1);
+
+	// last so that a pending load is waited for before anything it touches is destroyed
+	std::future<void> env_loading;
+	std::future<bool> scene_loading;
+};
+
+
+// coordinator <-> worker protocol, framed as described in net.h
+enum message_type : uint32_t
+{
+	msg_hello = 1,	// worker -> coordinator: u32 thread count
+	msg_job,		// coordinator -> worker: settings line, environment map path line, then save_scene() text
+	msg_tiles,		// coordinator -> worker: u32 count, then count x (u32 id, x0, y0, x1, y1)
+	msg_pixels,		// worker -> coordinator: u32 id, then the tile colors row by row as raw floats
+	msg_bye,		// coordinator -> worker: the frame is complete
+
+	msg_render = 16,	// client -> server: a render_job
+	msg_data,		// server -> client: a chunk of encoded image
+	msg_done,		// server -> client: the job is complete
+	msg_error,		// server -> client: the job failed, payload is the reason
+};
+
+std::string job_description(renderer const& render, const char* env_map_path)
+{
+	std::ostringstream out;
+	out.precision(std::numeric_limits<float>::max_digits10);
+	out << render.image_width() << ' ' << render.image_height() << ' ' << render.field_of_view() << ' '
+		<< render.max_depth << ' ' << render.msaa << ' ' << static_cast<int>(render.light_mode) << ' '
+		<< render.light_samples << ' ' << render.light_cutoff << ' ' << static_cast<int>(render.get_acceleration()) << ' '
+		<< render.camera_position() << render.camera_direction() << render.jitter << ' ' << render.frame << '\n'
+		<< env_map_path << '\n';
+	render.save_scene(out);
+	return out.str();
+}
+
+std::unique_ptr<renderer> renderer_from_job(std::string const& job)
+{
+	std::istringstream in(job);
+	size_t width, height;
+	float fov, light_cutoff;
+	unsigned max_depth, msaa, light_samples;
+	int light_mode, accel;
+	vec3f cam_pos, cam_dir;
+	bool jitter;
+	uint32_t frame;
+	std::string env_map_path;
+	in >> width >> height >> fov >> max_depth >> msaa >> light_mode >> light_samples >> light_cutoff >> accel
+		>> cam_pos.x >> cam_pos.y >> cam_pos.z >> cam_dir.x >> cam_dir.y >> cam_dir.z
+		>> jitter >> frame;
+	in.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+	if (!in || !std::getline(in, env_map_path))
+		return nullptr;
+
+	auto render = std::make_unique<renderer>(width, height, fov, env_map_path.c_str());
+	render->max_depth = max_depth;
+	render->msaa = msaa;
+	render->jitter = jitter;
+	render->frame = frame;
+	render->light_mode = static_cast<light_sampling>(light_mode);
+	render->light_samples = light_samples;
+	render->light_cutoff = light_cutoff;
+	render->set_acceleration(static_cast<acceleration>(accel));
+	render->set_camera(cam_pos, cam_dir);
+	if (!render->load_scene(in))
+		return nullptr;
+	return render;
+}
+
+// hands out the tiles of render's image to the workers connecting on port and assembles what they send back
+// tiles of a worker that disconnects are queued again, tiles running much longer than usual are issued a second time
+bool coordinate(renderer& render, const char* env_map_path, uint16_t port)
+{
+	using clock = std::chrono::steady_clock;
+
+	socket_t const listener = listen_tcp(port);
+	if (listener == invalid_socket)
+	{
+		std::cerr << "can't listen on port " << port << "\n";
+		return false;
+	}
+
+	struct tile_state
+	{
+		bool done = false;
+		unsigned owners = 0;		// workers currently rendering it
+		clock::time_point issued;
+	};
+
+	struct worker
+	{
+		socket_t s;
+		message_reader reader;
+		uint32_t threads = 0;		// 0 until hello
+		std::vector<uint32_t> in_flight;
+	};
+
+	std::vector<tile> const tiles = render.make_tiles(render.tile_size);
+	std::vector<tile_state> state(tiles.size());
+	std::vector<worker> workers;
+	std::string const job = job_description(render, env_map_path);
+	size_t done = 0, next_pending = 0;
+	double tile_seconds = 0.0;	// running average over finished tiles
+
+	auto const drop = [&](size_t w)
+	{
+		for (uint32_t id : workers[w].in_flight)
+			state[id].owners--;
+		if (!workers[w].in_flight.empty())
+			next_pending = 0;
+		close_socket(workers[w].s);
+		workers.erase(workers.begin() + w);
+		std::cerr << "worker lost, " << workers.size() << " left\n";
+	};
+
+	// first tile nobody renders yet, else the longest running straggler this worker doesn't already have
+	auto const pick = [&](worker const& w) -> int
+	{
+		for (; next_pending < tiles.size(); next_pending++)
+			if (!state[next_pending].done && state[next_pending].owners == 0)
+				return static_cast<int>(next_pending++);
+		double const slow = std::max(1.0, 4.0 * tile_seconds);
+		int best = -1;
+		for (size_t id = 0; id < tiles.size(); id++)
+		{
+			if (state[id].done || state[id].owners > 1 || std::find(w.in_flight.begin(), w.in_flight.end(), id) != w.in_flight.end())
+				continue;
+			if (std::chrono::duration<double>(clock::now() - state[id].issued).count() > slow && (best < 0 || state[id].issued < state[best].issued))
+				best = static_cast<int>(id);
+		}
+		return best;
+	};
+
+	while (done < tiles.size())
+	{
+		std::vector<pollfd> fds(workers.size() + 1);
+		fds[0] = { listener, POLLIN, 0 };
+		for (size_t w = 0; w < workers.size(); w++)
+			fds[w + 1] = { workers[w].s, POLLIN, 0 };
+		if (poll_sockets(fds.data(), fds.size(), 100) < 0)
+			break;
+
+		// walk backwards so dropping a worker doesn't shift the ones left to visit
+		for (size_t w = workers.size(); w-- > 0;)
+		{
+			if (!(fds[w + 1].revents & (POLLIN | POLLHUP | POLLERR)))
+				continue;
+			char buffer[1 << 16];
+			auto const n = recv(workers[w].s, buffer, sizeof(buffer), 0);
+			if (n <= 0)
 			{
-				c.x = 0.607;
-				c.y = 0.737;
-				c.z = 0.058;
+				drop(w);
+				continue;
 			}
-			else if (n > l2)
+			workers[w].reader.feed(buffer, static_cast<size_t>(n));
+
+			uint32_t type;
+			std::string payload;
+			bool ok = true;
+			while (ok && workers[w].reader.pop(type, payload))
 			{
-				c.x = 0.545;
-				c.y = 0.674;
-				c.z = 0.058;
+				if (type == msg_hello && payload.size() == 4)
+				{
+					workers[w].threads = std::max<uint32_t>(1, get_u32(payload.data()));
+					ok = send_message(workers[w].s, msg_job, job);
+				}
+				else if (type == msg_pixels && payload.size() >= 4)
+				{
+					uint32_t const id = get_u32(payload.data());
+					if (id >= tiles.size())
+					{
+						ok = false;
+						break;
+					}
+					tile const& t = tiles[id];
+					size_t const pixels = size_t(t.x1 - t.x0) * (t.y1 - t.y0);
+					if (payload.size() != 4 + pixels * sizeof(color))
+					{
+						ok = false;
+						break;
+					}
+					auto& in_flight = workers[w].in_flight;
+					if (auto const it = std::find(in_flight.begin(), in_flight.end(), id); it != in_flight.end())
+					{
+						in_flight.erase(it);
+						state[id].owners--;
+					}
+					if (!state[id].done)
+					{
+						std::vector<color> colors(pixels);
+						std::memcpy(colors.data(), payload.data() + 4, pixels * sizeof(color));
+						render.write_tile(t, colors.data());
+						state[id].done = true;
+						done++;
+						double const seconds = std::chrono::duration<double>(clock::now() - state[id].issued).count();
+						tile_seconds += (seconds - tile_seconds) / static_cast<double>(done);
+					}
+				}
+				else
+					ok = false;
+			}
+			if (!ok)
+				drop(w);
+		}
+
+		if (fds[0].revents & POLLIN)
+		{
+			socket_t const s = accept(listener, nullptr, nullptr);
+			if (s != invalid_socket)
+				workers.push_back({ s, {}, 0, {} });
+		}
 
+		// keep every worker busy with two batches, one rendering and one queued behind it
+		for (size_t w = workers.size(); w-- > 0;)
+		{
+			worker& wk = workers[w];
+			if (wk.threads == 0)
+				continue;
+			std::string batch;
+			uint32_t count = 0;
+			while (wk.in_flight.size() < 2 * wk.threads)
+			{
+				int const id = pick(wk);
+				if (id < 0)
+					break;
+				tile const& t = tiles[id];
+				for (uint32_t v : { static_cast<uint32_t>(id), t.x0, t.y0, t.x1, t.y1 })
+					put_u32(batch, v);
+				state[id].owners++;
+				state[id].issued = clock::now();
+				wk.in_flight.push_back(static_cast<uint32_t>(id));
+				count++;
 			}
-			else if (n > l3)
+			if (count == 0)
+				continue;
+			std::string payload;
+			put_u32(payload, count);
+			if (!send_message(wk.s, msg_tiles, payload + batch))
+				drop(w);
+		}
+	}
+
+	for (auto& w : workers)
+	{
+		send_message(w.s, msg_bye, {});
+		close_socket(w.s);
+	}
+	close_socket(listener);
+	return done == tiles.size();
+}
+
+// renders the tiles a coordinator sends until it says the frame is complete
+bool run_worker(const char* host, uint16_t port)
+{
+	socket_t const s = connect_tcp(host, port);
+	if (s == invalid_socket)
+	{
+		std::cerr << "can't connect to " << host << ":" << port << "\n";
+		return false;
+	}
+
+	std::string hello;
+	put_u32(hello, std::max(1u, std::thread::hardware_concurrency()));
+	std::unique_ptr<renderer> render;
+	uint32_t type;
+	std::string payload;
+	bool ok = send_message(s, msg_hello, hello);
+	while (ok && recv_message(s, type, payload))
+	{
+		if (type == msg_job)
+		{
+			render = renderer_from_job(payload);
+			ok = render != nullptr;
+		}
+		else if (type == msg_tiles && render && payload.size() >= 4)
+		{
+			uint32_t const count = get_u32(payload.data());
+			if (payload.size() != 4 + size_t(count) * 20)
+				break;
+			std::vector<uint32_t> ids(count);
+			std::vector<tile> batch(count);
+			for (uint32_t i = 0; i < count; i++)
 			{
-				c.x = 0.188;
-				c.y = 0.384;
-				c.z = 0.188;
+				char const* p = payload.data() + 4 + i * 20;
+				ids[i] = get_u32(p);
+				batch[i] = { get_u32(p + 4), get_u32(p + 8), get_u32(p + 12), get_u32(p + 16) };
+				if (batch[i].x0 >= batch[i].x1 || batch[i].x1 > render->image_width() || batch[i].y0 >= batch[i].y1 || batch[i].y1 > render->image_height())
+					ok = false;
+			}
+			if (!ok)
+				break;
+			render->render_tiles(batch.data(), batch.size());
+
+			std::vector<color> colors;
+			for (uint32_t i = 0; i < count && ok; i++)
+			{
+				colors.resize(size_t(batch[i].x1 - batch[i].x0) * (batch[i].y1 - batch[i].y0));
+				render->read_tile(batch[i], colors.data());
+				std::string pixels;
+				put_u32(pixels, ids[i]);
+				pixels.append(reinterpret_cast<char const*>(colors.data()), colors.size() * sizeof(color));
+				ok = send_message(s, msg_pixels, pixels);
+			}
+		}
+		else if (type == msg_bye)
+			break;
+		else
+			ok = false;
+	}
+	close_socket(s);
+	return ok;
+}
+
+// a render job sent to the server, one "key value" per line, any key may be left out:
+//	scene default | <scene file>	scenes and their textures stay loaded between jobs
+//	width 1920
+//	height 1080
+//	fov 1.2566
+//	spp 1
+//	jitter 0
+//	frame 0
+//	denoise 0	a-trous passes over the result, 0 disables the denoiser
+//	max_depth 1
+//	camera px py pz dx dy dz
+//	output - | <file> | shm:<name>
+// "-" streams the jpeg back as msg_data chunks followed by an empty msg_done, a file is written and its path
+// sent in msg_done, shm:<name> leaves rgba8 pixels in a POSIX shared memory object and msg_done says
+// "shm <name> <width> <height>", failures are reported with msg_error
+struct render_job
+{
+	std::string scene = "default";
+	size_t width = 1920, height = 1080;
+	float fov = M_PI/2.5;
+	unsigned spp = 1;
+	bool jitter = false;
+	uint32_t frame = 0;
+	unsigned denoise = 0;
+	unsigned max_depth = 1;
+	vec3f cam_pos = vec3f(0, 0, 0);
+	vec3f cam_dir = vec3f(0, 0, -1);
+	std::string output = "-";
+};
+
+bool parse_job(std::string const& text, render_job& job, std::string& error)
+{
+	std::istringstream in(text);
+	std::string line;
+	while (std::getline(in, line))
+	{
+		std::istringstream ls(line);
+		std::string key;
+		if (!(ls >> key))
+			continue;
+		if (key == "scene" || key == "output")
+		{
+			std::string& value = key == "scene" ? job.scene : job.output;
+			std::getline(ls >> std::ws, value);
+		}
+		else if (key == "width")
+			ls >> job.width;
+		else if (key == "height")
+			ls >> job.height;
+		else if (key == "fov")
+			ls >> job.fov;
+		else if (key == "spp")
+			ls >> job.spp;
+		else if (key == "jitter")
+			ls >> job.jitter;
+		else if (key == "frame")
+			ls >> job.frame;
+		else if (key == "denoise")
+			ls >> job.denoise;
+		else if (key == "max_depth")
+			ls >> job.max_depth;
+		else if (key == "camera")
+			ls >> job.cam_pos.x >> job.cam_pos.y >> job.cam_pos.z >> job.cam_dir.x >> job.cam_dir.y >> job.cam_dir.z;
+		else
+		{
+			error = "unknown job key " + key;
+			return false;
+		}
+		if (!ls)
+		{
+			error = "bad value for " + key;
+			return false;
+		}
+	}
+	if (job.width == 0 || job.height == 0 || job.width > 16384 || job.height > 16384 || job.spp == 0)
+	{
+		error = "bad image size or sample count";
+		return false;
+	}
+	return true;
+}
+
+// keeps scenes, acceleration structures and textures resident and renders the jobs clients send over a unix socket
+// clients are served one at a time, each job using every core
+bool serve(const char* socket_path, const char* env_map_path)
+{
+	socket_t const listener = listen_unix(socket_path);
+	if (listener == invalid_socket)
+	{
+		std::cerr << "can't listen on " << socket_path << "\n";
+		return false;
+	}
+
+	std::map<std::string, std::unique_ptr<renderer>> scenes;
+	auto const get_scene = [&](render_job const& job, std::string& error) -> renderer*
+	{
+		auto& render = scenes[job.scene];
+		if (render)
+			return render.get();
+		auto loaded = std::make_unique<renderer>(job.width, job.height, job.fov, env_map_path);
+		std::ifstream file;
+		if (job.scene != "default")
+			file.open(job.scene);
+		if (job.scene == "default" ? !loaded->init_scene() : !file || !loaded->load_scene(file))
+		{
+			scenes.erase(job.scene);
+			error = "can't load scene " + job.scene;
+			return nullptr;
+		}
+		loaded->build_acceleration();
+		render = std::move(loaded);
+		return render.get();
+	};
+
+	while (true)
+	{
+		socket_t const client = accept(listener, nullptr, nullptr);
+		if (client == invalid_socket)
+			continue;
+
+		uint32_t type;
+		std::string payload;
+		while (recv_message(client, type, payload))
+		{
+			render_job job;
+			std::string error = type == msg_render ? "" : "unexpected message";
+			renderer* render = nullptr;
+			if (error.empty() && parse_job(payload, job, error))
+				render = get_scene(job, error);
+			if (!render)
+			{
+				send_message(client, msg_error, error);
+				continue;
+			}
+
+			if (render->image_width() != job.width || render->image_height() != job.height)
+				render->resize(job.width, job.height);
+			render->set_fov(job.fov);
+			render->set_camera(job.cam_pos, job.cam_dir);
+			render->msaa = job.spp;
+			render->jitter = job.jitter;
+			render->frame = job.frame;
+			render->aux_buffers = job.denoise > 0;
+			render->max_depth = job.max_depth;
+			render->stats = {};
+			render->render();
+			render->denoise(job.denoise);
+
+			bool sent = true;
+			if (job.output == "-")
+			{
+				// stb hands out a few bytes at a time, send them in larger chunks
+				struct stream
+				{
+					socket_t s;
+					std::string chunk;
+					bool ok = true;
+
+					void flush()
+					{
+						ok = ok && send_message(s, msg_data, chunk);
+						chunk.clear();
+					}
+				} out = { client, {}, true };
+				render->save([](void* context, void* data, int size)
+				{
+					auto& o = *static_cast<stream*>(context);
+					o.chunk.append(static_cast<char const*>(data), size);
+					if (o.chunk.size() >= (1 << 16))
+						o.flush();
+				}, &out);
+				out.flush();
+				sent = out.ok && send_message(client, msg_done, {});
+			}
+			else if (job.output.compare(0, 4, "shm:") == 0)
+			{
+#ifndef _WIN32
+				std::string const name = job.output.substr(4);
+				std::vector<renderer::color8bit> const pixels = render->to_8bit();
+				size_t const bytes = pixels.size() * sizeof(renderer::color8bit);
+				int const fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0600);
+				void* const map = fd >= 0 && ftruncate(fd, bytes) == 0 ? mmap(nullptr, bytes, PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+				if (map != MAP_FAILED)
+				{
+					std::memcpy(map, pixels.data(), bytes);
+					munmap(map, bytes);
+					sent = send_message(client, msg_done, "shm " + name + " " + std::to_string(job.width) + " " + std::to_string(job.height));
+				}
+				else
+					sent = send_message(client, msg_error, "can't map shared memory " + name);
+				if (fd >= 0)
+					close(fd);
+#else
+				sent = send_message(client, msg_error, "shared memory output is not supported on this platform");
+#endif
 			}
 			else
 			{
-				c.x = 0.058;
-				c.y = 0.219;
-				c.z = 0.058;
+				render->save(job.output.c_str());
+				sent = send_message(client, msg_done, job.output);
 			}
+			if (!sent)
+				break;
 		}
+		close_socket(client);
 	}
-	
-	void save(const char* fileName = "out.jpg") const noexcept
+}
+
+// sends one job to a server and writes the streamed jpeg to output_path
+bool render_client(const char* socket_path, const char* output_path, std::string const& job)
+{
+	socket_t const s = connect_unix(socket_path);
+	if (s == invalid_socket)
 	{
-		struct color8bit {
-			uint8_t r, g, b, a;
-		};
-		
-		std::vector<color8bit> buffer(image.size());
-		for (size_t i = 0; i < buffer.size(); i++)
+		std::cerr << "can't connect to " << socket_path << "\n";
+		return false;
+	}
+	// opened with the first bytes of the image, a rejected job leaves no file behind
+	std::ofstream out;
+	bool ok = send_message(s, msg_render, job + "\noutput -\n");
+	uint32_t type;
+	std::string payload;
+	while (ok && recv_message(s, type, payload))
+	{
+		if (type == msg_data)
 		{
-			buffer[i].r = std::min<int>(image[i].x * 255, 255);
-			buffer[i].g = std::min<int>(image[i].y * 255, 255);
-			buffer[i].b = std::min<int>(image[i].z * 255, 255);
-			buffer[i].a = std::min<int>(image[i].w * 255, 255);
+			if (!out.is_open())
+				out.open(output_path, std::ios::binary);
+			out.write(payload.data(), payload.size());
+		}
+		else
+		{
+			if (type == msg_error)
+				std::cerr << "render failed : " << payload << "\n";
+			ok = type == msg_done;
+			break;
 		}
+	}
+	close_socket(s);
+	ok = ok && out.is_open() && out.good();
+	if (!ok && out.is_open())
+	{
+		out.close();
+		std::error_code ec;
+		std::filesystem::remove(output_path, ec);
+	}
+	return ok;
+}
 
-		stbi_write_jpg(fileName, width, height, 4, buffer.data(), 100);
+// renders a particle scene, or a generated one if given, with each acceleration structure and reports build time
+// and traversal speed
+void benchmark(size_t sphere_count, scene_params const* generated = nullptr)
+{
+	auto const populate = [&](renderer& render)
+	{
+		if (generated)
+			render.generate_scene(*generated);
+		else
+			render.init_particles(sphere_count, 1);
+	};
+	using clock = std::chrono::steady_clock;
+	std::pair<acceleration, const char*> const modes[] = { { acceleration::none, "none" }, { acceleration::grid, "grid" } };
+	for (auto const& [mode, name] : modes)
+	{
+		renderer render(640, 360, M_PI/2.5, "envmap.jpg");
+		render.set_acceleration(mode);
+		populate(render);
+
+		auto const start = clock::now();
+		render.build_acceleration();
+		auto const built = clock::now();
+		render.render();
+		auto const done = clock::now();
+
+		double const build_ms = std::chrono::duration<double, std::milli>(built - start).count();
+		double const trace_s = std::chrono::duration<double>(done - built).count();
+		uint64_t const rays = render.stats.rays + render.stats.shadow_rays;
+		std::cout << name << " : " << sphere_count << " spheres, build " << build_ms << " ms, "
+			<< rays << " rays in " << trace_s << " s, " << rays / trace_s / 1e6 << " Mrays/s, "
+			<< "scene memory " << render.scene_allocator().used() / (1024.0 * 1024.0) << " MiB\n";
 	}
 
-	color clear_color = Color::black;
-	unsigned max_depth = 1;
-	unsigned msaa = 1;
-	
-	private:
+	// pixel orders and tile sizes, on the same scene through the grid
+	renderer render(640, 360, M_PI/2.5, "envmap.jpg");
+	render.set_acceleration(acceleration::grid);
+	populate(render);
+	render.build_acceleration();
+	std::pair<pixel_order, const char*> const orders[] = { { pixel_order::row_major, "row major" }, { pixel_order::morton, "morton" }, { pixel_order::hilbert, "hilbert" } };
+	for (uint32_t const size : { 8u, 16u, 32u, 64u })
+	{
+		for (auto const& [order, name] : orders)
+		{
+			render.tile_size = size;
+			render.order = order;
+			// best of a few runs, the first one also warms the caches up
+			double best_s = std::numeric_limits<double>::max();
+			for (int run = 0; run < 3; run++)
+			{
+				auto const start = clock::now();
+				render.render();
+				best_s = std::min(best_s, std::chrono::duration<double>(clock::now() - start).count());
+			}
+			std::cout << "tile " << size << " " << name << " : " << best_s * 1000 << " ms\n";
+		}
+	}
+}
 
-	texture env_map;
-	
-	std::vector<plan> plans;
-	std::vector<sphere> spheres;
-	
-	std::vector<light> lights;
-	std::vector<color> image;
+// "key value" lines, any key of scene_params may be left out
+bool parse_scene_params(std::string const& text, scene_params& p, std::string& error)
+{
+	std::istringstream in(text);
+	std::string line;
+	while (std::getline(in, line))
+	{
+		std::istringstream ls(line);
+		std::string key;
+		if (!(ls >> key))
+			continue;
+		if (key == "spheres")
+			ls >> p.spheres;
+		else if (key == "radius")
+			ls >> p.radius;
+		else if (key == "size_range")
+			ls >> p.size_range;
+		else if (key == "size_power")
+			ls >> p.size_power;
+		else if (key == "clusters")
+			ls >> p.clusters;
+		else if (key == "cluster_spread")
+			ls >> p.cluster_spread;
+		else if (key == "mirrors")
+			ls >> p.mirrors;
+		else if (key == "glass")
+			ls >> p.glass;
+		else if (key == "lights")
+			ls >> p.lights;
+		else if (key == "plans")
+			ls >> p.plans;
+		else if (key == "seed")
+			ls >> p.seed;
+		else
+		{
+			error = "unknown scene key " + key;
+			return false;
+		}
+		if (!ls)
+		{
+			error = "bad value for " + key;
+			return false;
+		}
+	}
+	if (p.size_range < 1.0f || p.size_power <= 0.0f || p.mirrors < 0.0f || p.glass < 0.0f || p.mirrors + p.glass > 1.0f)
+	{
+		error = "bad size distribution or material mix";
+		return false;
+	}
+	return true;
+}
+
+// reference scenes of the regression suite, each rendered the same way every run
+struct regression_case
+{
+	const char* name;
 	size_t width, height;
-	float fov;
-	vec3f camPos;
-	vec3f camDir;
+	double min_psnr;		// dB against the golden image, optimizations reordering float math cost a little
+	double min_psnr_fused;	// same for builds that may fuse or reorder float operations, see regress()
+	double budget_ms;		// build and median render, a little over twice what one core of a desktop needs
+	void (*setup)(renderer&);
+};
+
+// a lattice of glass and mirror spheres over a mirror floor, most rays bounce to the depth limit
+void init_glass_lattice(renderer& render)
+{
+	std::ostringstream scene;
+	scene << "material 0.6 0.7 0.8 1 0.15 0 0.5 0.8 0 1.5 125\n"
+		<< "material 1 1 1 1 0.15 0 0.9 0 0.8 1 1425\n"
+		<< "material 0.4 0.4 0.3 1 0.15 0.6 0.3 0 0.3 1 50\n";
+	for (int z = 0; z < 4; z++)
+		for (int y = 0; y < 3; y++)
+			for (int x = 0; x < 6; x++)
+				scene << "sphere " << x * 4 - 10 << ' ' << y * 4 - 3 << ' ' << -14 - z * 5 << " 1.6 " << (x + y + z) % 2 << '\n';
+	scene << "plane 0 -6 0 0 1 0 2\n"
+		<< "light -20 20 20 1.5\nlight 30 50 -25 1.8\nlight 0 0 0 1.7\n";
+	std::istringstream in(scene.str());
+	render.load_scene(in);
+}
+
+regression_case const regression_suite[] = {
+	// the sub pixel spheres of the large particle scenes appear or vanish with the last bit of a root, so they are
+	// the ones fused multiply adds change the most
+	{ "default", 960, 540, 45.0, 45.0, 100.0, [](renderer& r) { r.init_scene(); } },
+	{ "mirrors", 960, 540, 40.0, 40.0, 400.0, [](renderer& r) { r.init_scene(); r.max_depth = 6; r.msaa = 4; r.jitter = true; } },
+	{ "glass", 960, 540, 40.0, 40.0, 2500.0, [](renderer& r) { init_glass_lattice(r); r.max_depth = 6; } },
+	{ "spheres_1k", 640, 360, 45.0, 45.0, 500.0, [](renderer& r) { r.set_acceleration(acceleration::grid); r.init_particles(1000, 1); } },
+	{ "spheres_100k", 640, 360, 45.0, 40.0, 1100.0, [](renderer& r) { r.set_acceleration(acceleration::grid); r.init_particles(100000, 1); } },
+	{ "spheres_1M", 640, 360, 45.0, 35.0, 2000.0, [](renderer& r) { r.set_acceleration(acceleration::grid); r.init_particles(1000000, 1); } },
 };
 
+// the goldens are rendered by a build that keeps every float operation as written (/fp:precise, -ffp-contract=off),
+// others are held to min_psnr_fused, which can't tell whether the compiler contracted when FMA is available
+#if defined(_M_FP_FAST) || defined(__FAST_MATH__) || defined(__FMA__) || defined(__AVX2__)
+constexpr bool exact_float_math = false;
+#else
+constexpr bool exact_float_math = true;
+#endif
+
+// renders regression_suite against the golden images kept in dir, false if an image changed or has no golden, or a
+// case went over its time budget
+// update records the goldens instead, they are committed and don't depend on envmap.jpg, the scenes use a clear color
+bool regress(std::string const& dir, bool update)
+{
+	using clock = std::chrono::steady_clock;
+	std::error_code ec;
+	std::filesystem::create_directories(dir, ec);
+	if (!exact_float_math)
+		std::cout << "this build may fuse float operations, comparing with the looser psnr floors\n";
+	bool ok = true;
+	for (regression_case const& c : regression_suite)
+	{
+		renderer render(c.width, c.height, M_PI/2.5);
+		render.clear_color = {0.7f, 0.7f, 0.7f , 1.0f};
+		c.setup(render);
+		// build once, then the median of a few renders
+		auto const start = clock::now();
+		render.build_acceleration();
+		double const build_s = std::chrono::duration<double>(clock::now() - start).count();
+		double render_s[5];
+		for (double& s : render_s)
+		{
+			auto const begin = clock::now();
+			render.render();
+			s = std::chrono::duration<double>(clock::now() - begin).count();
+		}
+		std::nth_element(std::begin(render_s), render_s + 2, std::end(render_s));
+		double const ms = (build_s + render_s[2]) * 1000;
+
+		std::string const image_path = dir + "/" + c.name + ".png";
+		std::vector<renderer::color8bit> const pixels = render.to_8bit();
+		if (update)
+		{
+			bool const saved = stbi_write_png(image_path.c_str(), c.width, c.height, 4, pixels.data(), c.width * 4) != 0;
+			std::cout << c.name << " : " << ms << " ms, " << (saved ? "recorded" : "can't write golden") << "\n";
+			ok = ok && saved;
+			continue;
+		}
+
+		int golden_width = 0, golden_height = 0, channels = 0;
+		stbi_uc* const golden = stbi_load(image_path.c_str(), &golden_width, &golden_height, &channels, 4);
+		if (!golden)
+		{
+			std::cout << c.name << " : NO GOLDEN " << image_path << ", --update records it\n";
+			ok = false;
+			continue;
+		}
+		double psnr = 0.0;
+		if (size_t(golden_width) == c.width && size_t(golden_height) == c.height)
+		{
+			double squared = 0.0;
+			for (size_t i = 0; i < pixels.size(); i++)
+			{
+				int const d[3] = { pixels[i].r - golden[4 * i], pixels[i].g - golden[4 * i + 1], pixels[i].b - golden[4 * i + 2] };
+				squared += d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+			}
+			double const mse = squared / (3.0 * pixels.size());
+			psnr = mse > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : std::numeric_limits<double>::infinity();
+		}
+		stbi_image_free(golden);
+		double const min_psnr = exact_float_math ? c.min_psnr : c.min_psnr_fused;
+		bool const image_ok = psnr >= min_psnr;
+		bool const time_ok = ms <= c.budget_ms;
+		std::cout << c.name << " : psnr " << psnr << " dB (min " << min_psnr << "), " << ms << " ms (budget " << c.budget_ms << " ms), "
+			<< (image_ok && time_ok ? "ok" : !image_ok ? "IMAGE CHANGED" : "TOO SLOW") << "\n";
+		ok = ok && image_ok && time_ok;
+	}
+	return ok;
+}
 
-int main()
+int main(int argc, char** argv)
 {
-	renderer render(1920, 1080, M_PI/2.5, "envmap.jpg");
+	// stress scene generator, writes the scene made from the remaining "key value" pairs, see scene_params
+	if (argc > 2 && std::strcmp(argv[1], "--generate") == 0)
+	{
+		std::string text, error;
+		for (int i = 3; i + 1 < argc; i += 2)
+			text += std::string(argv[i]) + " " + argv[i + 1] + "\n";
+		scene_params params;
+		if (!parse_scene_params(text, params, error))
+		{
+			std::cerr << error << "\n";
+			return 1;
+		}
+		renderer render(1920, 1080, M_PI/2.5);
+		if (!render.generate_scene(params))
+			return 1;
+		std::ofstream out(argv[2]);
+		render.save_scene(out);
+		return out ? 0 : 1;
+	}
+
+	// regression suite against the goldens in dir (regress by default), --update rerecords them
+	if (argc > 1 && std::strcmp(argv[1], "--regress") == 0)
+	{
+		bool const update = argc > 2 && std::strcmp(argv[argc - 1], "--update") == 0;
+		return regress(argc > 2 + update ? argv[2] : "regress", update) ? 0 : 1;
+	}
+
+	// any "key value" pairs after the count bench a generate_scene() scene instead of the particles
+	if (argc > 1 && std::strcmp(argv[1], "--bench") == 0)
+	{
+		size_t const count = argc > 2 ? std::stoul(argv[2]) : 2000;
+		if (argc < 5)
+		{
+			benchmark(count);
+			return 0;
+		}
+		std::string text, error;
+		for (int i = 3; i + 1 < argc; i += 2)
+			text += std::string(argv[i]) + " " + argv[i + 1] + "\n";
+		scene_params params;
+		params.spheres = count;
+		if (!parse_scene_params(text, params, error))
+		{
+			std::cerr << error << "\n";
+			return 1;
+		}
+		benchmark(count, &params);
+		return 0;
+	}
+
+	// persistent server mode, and a client sending it a job made of the remaining "key value" pairs
+	if (argc > 2 && std::strcmp(argv[1], "--serve") == 0)
+		return serve(argv[2], "envmap.jpg") ? 0 : 1;
+	if (argc > 3 && std::strcmp(argv[1], "--client") == 0)
+	{
+		std::string job;
+		for (int i = 4; i + 1 < argc; i += 2)
+			job += std::string(argv[i]) + " " + argv[i + 1] + "\n";
+		return render_client(argv[2], argv[3], job) ? 0 : 1;
+	}
+
+	// distributed rendering: one coordinator owning the scene, any number of workers
+	if (argc > 3 && std::strcmp(argv[1], "--worker") == 0)
+	{
+		net_init();
+		return run_worker(argv[2], static_cast<uint16_t>(std::stoul(argv[3]))) ? 0 : 1;
+	}
+	if (argc > 2 && std::strcmp(argv[1], "--coordinator") == 0)
+	{
+		net_init();
+		renderer render(1920, 1080, M_PI/2.5, "envmap.jpg");
+		if (!render.init_scene() || !coordinate(render, "envmap.jpg", static_cast<uint16_t>(std::stoul(argv[2]))))
+			return 1;
+		render.save(argc > 3 ? argv[3] : "out.jpg");
+		return 0;
+	}
+
+	// the default render, --trace <file> also writes its timeline there
+	char const* const trace_path = argc > 2 && std::strcmp(argv[1], "--trace") == 0 ? argv[2] : nullptr;
+	if (trace_path)
+		trace::enable();
+	renderer render(1920, 1080, M_PI/2.5);
 	render.clear_color = {0.7f, 0.7f, 0.7f , 1.0f};
-	render.init_scene();
+	render.load_async("envmap.jpg");
+	if (!render.wait_loaded())
+		return 1;
+	//render.light_mode = light_sampling::tree;
+	//render.order = pixel_order::hilbert;
+	//render.aux_buffers = true;
 	render.render();
+	//render.render_within(std::chrono::milliseconds(100)).print(std::cout);
+	//render.render_progressive([&](uint32_t step) { render.save(("preview " + std::to_string(step) + ".jpg").c_str()); });
+	//render.edit_primitive(2, [](sphere& s) { s.geom.y += 1; });
+	//render.render_dirty();
+	render.stats.print(std::cout);
+	//render.denoise();
 	render.save();
 	//render.game_boy_pass();
 	//render.save("out gameboy.jpg");
+	if (trace_path)
+	{
+		trace::disable();
+		if (!trace::save(trace_path))
+			return 1;
+	}
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,84 @@
+#ifndef __MAPPED_FILE_H__
+#define __MAPPED_FILE_H__
+#include <cstddef>
+#include <memory>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// read only memory mapping of a whole file, pages are loaded lazily by the OS and shared between processes
+class mapped_file
+{
+public:
+	// nullptr if the file can't be opened or is empty
+	static std::unique_ptr<mapped_file> open(const char* path)
+	{
+		std::unique_ptr<mapped_file> f(new mapped_file);
+#ifdef _WIN32
+		HANDLE const file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+			return nullptr;
+		LARGE_INTEGER size;
+		HANDLE const mapping = GetFileSizeEx(file, &size) && size.QuadPart > 0 ? CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+		CloseHandle(file);
+		if (!mapping)
+			return nullptr;
+		f->bytes = static_cast<std::byte const*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+		CloseHandle(mapping);
+		f->length = static_cast<size_t>(size.QuadPart);
+#else
+		int const fd = ::open(path, O_RDONLY);
+		if (fd < 0)
+			return nullptr;
+		struct stat st;
+		if (fstat(fd, &st) == 0 && st.st_size > 0)
+		{
+			void* const p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+			if (p != MAP_FAILED)
+			{
+				f->bytes = static_cast<std::byte const*>(p);
+				f->length = static_cast<size_t>(st.st_size);
+			}
+		}
+		close(fd);
+#endif
+		return f->bytes ? std::move(f) : nullptr;
+	}
+
+	~mapped_file()
+	{
+		if (!bytes)
+			return;
+#ifdef _WIN32
+		UnmapViewOfFile(bytes);
+#else
+		munmap(const_cast<std::byte*>(bytes), length);
+#endif
+	}
+
+	mapped_file(mapped_file const&) = delete;
+	mapped_file& operator=(mapped_file const&) = delete;
+
+	[[nodiscard]] std::byte const* data() const noexcept { return bytes; }
+	[[nodiscard]] size_t size() const noexcept { return length; }
+
+private:
+	mapped_file() = default;
+
+	std::byte const* bytes = nullptr;
+	size_t length = 0;
+};
+
+#endif //__MAPPED_FILE_H__
@@ -0,0 +1,220 @@
+#ifndef __NET_H__
+#define __NET_H__
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+// minimal blocking TCP and unix domain socket helpers and the length-prefixed framing used between renderer processes
+// a message is: u32 type, u32 payload size, payload, integers are little endian
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <afunix.h>
+#pragma comment(lib, "ws2_32.lib")
+using socket_t = SOCKET;
+constexpr socket_t invalid_socket = INVALID_SOCKET;
+inline void close_socket(socket_t s) { closesocket(s); }
+inline int poll_sockets(pollfd* fds, size_t count, int timeout_ms) { return WSAPoll(fds, static_cast<ULONG>(count), timeout_ms); }
+constexpr int send_flags = 0;
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+using socket_t = int;
+constexpr socket_t invalid_socket = -1;
+inline void close_socket(socket_t s) { close(s); }
+inline int poll_sockets(pollfd* fds, size_t count, int timeout_ms) { return poll(fds, count, timeout_ms); }
+#ifdef MSG_NOSIGNAL
+constexpr int send_flags = MSG_NOSIGNAL;	// a dead peer must show up as an error, not kill us with SIGPIPE
+#else
+constexpr int send_flags = 0;
+#endif
+#endif
+
+inline bool net_init()
+{
+#ifdef _WIN32
+	WSADATA data;
+	return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+#else
+	return true;
+#endif
+}
+
+inline void put_u32(std::string& out, uint32_t v)
+{
+	char const b[4] = { char(v & 0xff), char((v >> 8) & 0xff), char((v >> 16) & 0xff), char((v >> 24) & 0xff) };
+	out.append(b, 4);
+}
+
+inline uint32_t get_u32(char const* p)
+{
+	unsigned char const* b = reinterpret_cast<unsigned char const*>(p);
+	return uint32_t(b[0]) | uint32_t(b[1]) << 8 | uint32_t(b[2]) << 16 | uint32_t(b[3]) << 24;
+}
+
+// listens on every interface, returns invalid_socket on failure
+inline socket_t listen_tcp(uint16_t port)
+{
+	socket_t const s = socket(AF_INET, SOCK_STREAM, 0);
+	if (s == invalid_socket)
+		return invalid_socket;
+	int const yes = 1;
+	setsockopt(s, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<char const*>(&yes), sizeof(yes));
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+	if (bind(s, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(s, 64) != 0)
+	{
+		close_socket(s);
+		return invalid_socket;
+	}
+	return s;
+}
+
+inline socket_t connect_tcp(char const* host, uint16_t port)
+{
+	addrinfo hints = {};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	addrinfo* res = nullptr;
+	if (getaddrinfo(host, std::to_string(port).c_str(), &hints, &res) != 0)
+		return invalid_socket;
+	socket_t s = invalid_socket;
+	for (addrinfo* it = res; it && s == invalid_socket; it = it->ai_next)
+	{
+		s = socket(it->ai_family, it->ai_socktype, it->ai_protocol);
+		if (s != invalid_socket && connect(s, it->ai_addr, static_cast<int>(it->ai_addrlen)) != 0)
+		{
+			close_socket(s);
+			s = invalid_socket;
+		}
+	}
+	freeaddrinfo(res);
+	if (s != invalid_socket)
+	{
+		int const yes = 1;
+		setsockopt(s, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<char const*>(&yes), sizeof(yes));
+	}
+	return s;
+}
+
+// a stale socket file left at path by a previous run is removed first
+inline socket_t listen_unix(char const* path)
+{
+	sockaddr_un addr = {};
+	if (std::strlen(path) >= sizeof(addr.sun_path))
+		return invalid_socket;
+	socket_t const s = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (s == invalid_socket)
+		return invalid_socket;
+	addr.sun_family = AF_UNIX;
+	std::strcpy(addr.sun_path, path);
+	std::remove(path);
+	if (bind(s, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(s, 16) != 0)
+	{
+		close_socket(s);
+		return invalid_socket;
+	}
+	return s;
+}
+
+inline socket_t connect_unix(char const* path)
+{
+	sockaddr_un addr = {};
+	if (std::strlen(path) >= sizeof(addr.sun_path))
+		return invalid_socket;
+	socket_t s = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (s == invalid_socket)
+		return invalid_socket;
+	addr.sun_family = AF_UNIX;
+	std::strcpy(addr.sun_path, path);
+	if (connect(s, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0)
+	{
+		close_socket(s);
+		s = invalid_socket;
+	}
+	return s;
+}
+
+inline bool send_all(socket_t s, char const* data, size_t size)
+{
+	while (size > 0)
+	{
+		auto const n = send(s, data, static_cast<int>(std::min<size_t>(size, 1 << 30)), send_flags);
+		if (n <= 0)
+			return false;
+		data += n;
+		size -= static_cast<size_t>(n);
+	}
+	return true;
+}
+
+inline bool recv_all(socket_t s, char* data, size_t size)
+{
+	while (size > 0)
+	{
+		auto const n = recv(s, data, static_cast<int>(std::min<size_t>(size, 1 << 30)), 0);
+		if (n <= 0)
+			return false;
+		data += n;
+		size -= static_cast<size_t>(n);
+	}
+	return true;
+}
+
+inline bool send_message(socket_t s, uint32_t type, std::string const& payload)
+{
+	std::string header;
+	put_u32(header, type);
+	put_u32(header, static_cast<uint32_t>(payload.size()));
+	return send_all(s, header.data(), header.size()) && send_all(s, payload.data(), payload.size());
+}
+
+// blocks until a whole message arrived, false if the peer went away
+inline bool recv_message(socket_t s, uint32_t& type, std::string& payload)
+{
+	char header[8];
+	if (!recv_all(s, header, sizeof(header)))
+		return false;
+	type = get_u32(header);
+	payload.resize(get_u32(header + 4));
+	return recv_all(s, payload.data(), payload.size());
+}
+
+// incremental reader for sockets multiplexed with poll, feed() whatever recv returned then pop() whole messages
+struct message_reader
+{
+	std::string buffer;
+
+	void feed(char const* data, size_t size) { buffer.append(data, size); }
+
+	bool pop(uint32_t& type, std::string& payload)
+	{
+		if (buffer.size() < 8)
+			return false;
+		uint32_t const size = get_u32(buffer.data() + 4);
+		if (buffer.size() < 8 + size_t(size))
+			return false;
+		type = get_u32(buffer.data());
+		payload.assign(buffer, 8, size);
+		buffer.erase(0, 8 + size_t(size));
+		return true;
+	}
+};
+
+#endif //__NET_H__
@@ -0,0 +1,198 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+// timeline of what every thread did, exported as Chrome trace JSON (ui.perfetto.dev, chrome://tracing)
+// off until enable(), a scope then costs two clock reads and a store into the ring of its thread, the oldest
+// events being overwritten once it is full, and a relaxed load otherwise
+namespace trace
+{
+	using clock = std::chrono::steady_clock;
+
+	struct event
+	{
+		const char* name;	// string literals only, they are kept by pointer
+		const char* category;
+		uint64_t begin_ns, end_ns;
+		int32_t x, y;		// position of tiles, negative for the other events
+	};
+
+	struct thread_buffer
+	{
+		std::vector<event> ring;
+		size_t next = 0;	// total events recorded, the ring holds the last ring.size() of them
+		uint32_t id = 0;
+		bool in_use = true;	// false once its thread exited
+	};
+
+	struct state
+	{
+		std::atomic<bool> enabled{ false };
+		size_t ring_size = 0;
+		clock::time_point epoch;
+		std::mutex lock;
+		std::vector<std::unique_ptr<thread_buffer>> buffers;
+		uint32_t next_id = 0;
+	};
+
+	inline state& global() noexcept
+	{
+		static state s;
+		return s;
+	}
+
+	// the buffer of the calling thread, it outlives the thread so that its events still get exported
+	inline thread_buffer& local()
+	{
+		struct owner
+		{
+			thread_buffer* buffer = nullptr;
+			~owner()
+			{
+				if (buffer)
+				{
+					std::lock_guard<std::mutex> guard(global().lock);
+					buffer->in_use = false;
+				}
+			}
+		};
+		thread_local owner o;
+		if (!o.buffer)
+		{
+			state& s = global();
+			std::lock_guard<std::mutex> guard(s.lock);
+			s.buffers.push_back(std::make_unique<thread_buffer>());
+			o.buffer = s.buffers.back().get();
+			o.buffer->id = s.next_id++;
+		}
+		return *o.buffer;
+	}
+
+	[[nodiscard]] inline bool enabled() noexcept
+	{
+		return global().enabled.load(std::memory_order_relaxed);
+	}
+
+	// starts a new timeline, forgetting the previous one and the threads that exited since, with room for the last
+	// events_per_thread events of each thread
+	inline void enable(size_t events_per_thread = 1 << 16)
+	{
+		state& s = global();
+		std::lock_guard<std::mutex> guard(s.lock);
+		s.ring_size = events_per_thread;
+		s.epoch = clock::now();
+		s.buffers.erase(std::remove_if(s.buffers.begin(), s.buffers.end(), [](auto const& b) { return !b->in_use; }), s.buffers.end());
+		for (auto& b : s.buffers)
+		{
+			b->ring.clear();
+			b->next = 0;
+		}
+		s.enabled.store(true, std::memory_order_relaxed);
+	}
+
+	inline void disable() noexcept
+	{
+		global().enabled.store(false, std::memory_order_relaxed);
+	}
+
+	inline void record(const char* name, const char* category, clock::time_point begin, clock::time_point end, int32_t x = -1, int32_t y = -1)
+	{
+		state& s = global();
+		thread_buffer& b = local();
+		if (b.ring.size() != s.ring_size)
+		{
+			b.ring.assign(s.ring_size, {});
+			b.next = 0;
+		}
+		if (b.ring.empty())
+			return;
+		auto const ns = [&](clock::time_point t) { return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(t - s.epoch).count()); };
+		b.ring[b.next++ % b.ring.size()] = { name, category, ns(begin), ns(end), x, y };
+	}
+
+	// records its lifetime as one event, if recording was on when it started
+	class scope
+	{
+	public:
+		scope(const char* iname, const char* icategory, int32_t ix = -1, int32_t iy = -1) noexcept
+		: name(iname), category(icategory), x(ix), y(iy)
+		{
+			if (enabled())
+				begin = clock::now();
+		}
+
+		~scope()
+		{
+			if (begin == clock::time_point{} || !enabled())
+				return;
+			// a thread that can't get its ring loses the event rather than the process
+			try
+			{
+				record(name, category, begin, clock::now(), x, y);
+			}
+			catch (...)
+			{
+			}
+		}
+
+		scope(scope const&) = delete;
+		scope& operator=(scope const&) = delete;
+
+	private:
+		const char* name;
+		const char* category;
+		int32_t x, y;
+		clock::time_point begin{};
+	};
+
+	// every recorded event as complete ("X") events, times in microseconds since enable()
+	// threads must not be recording meanwhile, call it between frames or after disable()
+	inline void write_json(std::ostream& out)
+	{
+		state& s = global();
+		std::lock_guard<std::mutex> guard(s.lock);
+		auto const flags = out.flags();
+		auto const precision = out.precision(3);
+		out << std::fixed << "{\"traceEvents\":[\n";
+		bool first = true;
+		for (auto const& b : s.buffers)
+		{
+			if (b->next == 0)
+				continue;
+			out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << b->id
+				<< ",\"args\":{\"name\":\"thread " << b->id << "\"}}";
+			first = false;
+			size_t const count = std::min(b->next, b->ring.size());
+			for (size_t i = b->next - count; i < b->next; i++)
+			{
+				event const& e = b->ring[i % b->ring.size()];
+				out << ",\n{\"name\":\"" << e.name << "\",\"cat\":\"" << e.category << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << b->id
+					<< ",\"ts\":" << e.begin_ns / 1000.0 << ",\"dur\":" << (e.end_ns - e.begin_ns) / 1000.0;
+				if (e.x >= 0)
+					out << ",\"args\":{\"x\":" << e.x << ",\"y\":" << e.y << "}";
+				out << "}";
+			}
+		}
+		out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+		out.flags(flags);
+		out.precision(precision);
+	}
+
+	inline bool save(const char* path)
+	{
+		std::ofstream out(path);
+		write_json(out);
+		return out.good();
+	}
+}
+
+#endif //__TRACE_H__